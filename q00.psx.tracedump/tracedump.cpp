@@ -0,0 +1,211 @@
+/*
+	q00.psx.tracedump - decodes and disassembles the binary CPU traces of q00.psx --trace
+
+	usage: q00.psx.tracedump <trace file> [last N entries]
+*/
+#define _CRT_SECURE_NO_WARNINGS
+#include "../q00.psx/defs.h"
+#include "../q00.psx/trace.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+static const char* REG_LUT[] = {
+	"zero", "at", "v0", "v1", "a0", "a1", "a2", "a3",
+	"t0", "t1", "t2", "t3", "t4", "t5", "t6", "t7",
+	"s0", "s1", "s2", "s3", "s4", "s5", "s6", "s7",
+	"t8", "t9", "k0", "k1", "gp", "sp", "fp", "ra"
+};
+
+static const char* GTE_COMMANDS[64] = {
+	nullptr, "rtps", nullptr, nullptr, nullptr, nullptr, "nclip", nullptr,
+	nullptr, nullptr, nullptr, nullptr, "op", nullptr, nullptr, nullptr,
+	"dpcs", "intpl", "mvmva", "ncds", "cdp", nullptr, "ncdt", nullptr,
+	nullptr, nullptr, nullptr, "nccs", "cc", nullptr, "ncs", nullptr,
+	"nct", nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr,
+	"sqr", "dcpl", "dpct", nullptr, nullptr, "avsz3", "avsz4", nullptr,
+	"rtpt", nullptr, nullptr, nullptr, nullptr, nullptr, nullptr, nullptr,
+	nullptr, nullptr, nullptr, nullptr, nullptr, "gpf", "gpl", "ncct"
+};
+
+//	which register an instruction writes, so the right traced value gets printed
+enum class Dest { None, RT, RD, RA };
+
+struct Disassembly {
+	std::string text;
+	Dest dest = Dest::None;
+};
+
+static std::string format(const char* fmt, ...) {
+	char buf[128];
+	va_list args;
+	va_start(args, fmt);
+	vsnprintf(buf, sizeof(buf), fmt, args);
+	va_end(args);
+	return buf;
+}
+
+static Disassembly disassemble(word pc, word opcode) {
+	const u8 primary = opcode >> 26;
+	const u8 rs = (opcode >> 21) & 0x1f;
+	const u8 rt = (opcode >> 16) & 0x1f;
+	const u8 rd = (opcode >> 11) & 0x1f;
+	const u8 imm5 = (opcode >> 6) & 0x1f;
+	const u8 funct = opcode & 0x3f;
+	const i32 simm = (i16)(opcode & 0xffff);
+	const u32 zimm = opcode & 0xffff;
+	const word branchTarget = pc + 4 + (simm << 2);
+	const word jumpTarget = ((pc + 4) & 0xf000'0000) | ((opcode & 0x3ff'ffff) << 2);
+
+	auto r3 = [&](const char* m) { return Disassembly{ format("%-7s %s, %s, %s", m, REG_LUT[rd], REG_LUT[rs], REG_LUT[rt]), Dest::RD }; };
+	auto shift = [&](const char* m) { return Disassembly{ format("%-7s %s, %s, %d", m, REG_LUT[rd], REG_LUT[rt], imm5), Dest::RD }; };
+	auto shiftv = [&](const char* m) { return Disassembly{ format("%-7s %s, %s, %s", m, REG_LUT[rd], REG_LUT[rt], REG_LUT[rs]), Dest::RD }; };
+	auto muldiv = [&](const char* m) { return Disassembly{ format("%-7s %s, %s", m, REG_LUT[rs], REG_LUT[rt]) }; };
+	auto immS = [&](const char* m) { return Disassembly{ format("%-7s %s, %s, %d", m, REG_LUT[rt], REG_LUT[rs], simm), Dest::RT }; };
+	auto immZ = [&](const char* m) { return Disassembly{ format("%-7s %s, %s, 0x%x", m, REG_LUT[rt], REG_LUT[rs], zimm), Dest::RT }; };
+	auto load = [&](const char* m) { return Disassembly{ format("%-7s %s, %d(%s)", m, REG_LUT[rt], simm, REG_LUT[rs]), Dest::RT }; };
+	auto store = [&](const char* m) { return Disassembly{ format("%-7s %s, %d(%s)", m, REG_LUT[rt], simm, REG_LUT[rs]) }; };
+	auto cop = [&](const char* m, u8 reg, Dest dest) { return Disassembly{ format("%s%d    %s, cop%dr%d", m, primary & 3, REG_LUT[rt], primary & 3, reg), dest }; };
+
+	switch (primary) {
+		case 0x00:
+			switch (funct) {
+				case 0x00: return (opcode == 0) ? Disassembly{ "nop" } : shift("sll");
+				case 0x02: return shift("srl");
+				case 0x03: return shift("sra");
+				case 0x04: return shiftv("sllv");
+				case 0x06: return shiftv("srlv");
+				case 0x07: return shiftv("srav");
+				case 0x08: return { format("%-7s %s", "jr", REG_LUT[rs]) };
+				case 0x09: return { format("%-7s %s, %s", "jalr", REG_LUT[rd], REG_LUT[rs]), Dest::RD };
+				case 0x0c: return { "syscall" };
+				case 0x0d: return { "break" };
+				case 0x10: return { format("%-7s %s", "mfhi", REG_LUT[rd]), Dest::RD };
+				case 0x11: return { format("%-7s %s", "mthi", REG_LUT[rs]) };
+				case 0x12: return { format("%-7s %s", "mflo", REG_LUT[rd]), Dest::RD };
+				case 0x13: return { format("%-7s %s", "mtlo", REG_LUT[rs]) };
+				case 0x18: return muldiv("mult");
+				case 0x19: return muldiv("multu");
+				case 0x1a: return muldiv("div");
+				case 0x1b: return muldiv("divu");
+				case 0x20: return r3("add");
+				case 0x21: return r3("addu");
+				case 0x22: return r3("sub");
+				case 0x23: return r3("subu");
+				case 0x24: return r3("and");
+				case 0x25: return r3("or");
+				case 0x26: return r3("xor");
+				case 0x27: return r3("nor");
+				case 0x2a: return r3("slt");
+				case 0x2b: return r3("sltu");
+			}
+			break;
+		case 0x01: {
+			const bool link = (rt & 0x1e) == 0x10;
+			const char* m = (rt & 1) ? (link ? "bgezal" : "bgez") : (link ? "bltzal" : "bltz");
+			return { format("%-7s %s, 0x%08x", m, REG_LUT[rs], branchTarget), link ? Dest::RA : Dest::None };
+		}
+		case 0x02: return { format("%-7s 0x%08x", "j", jumpTarget) };
+		case 0x03: return { format("%-7s 0x%08x", "jal", jumpTarget), Dest::RA };
+		case 0x04: return { format("%-7s %s, %s, 0x%08x", "beq", REG_LUT[rs], REG_LUT[rt], branchTarget) };
+		case 0x05: return { format("%-7s %s, %s, 0x%08x", "bne", REG_LUT[rs], REG_LUT[rt], branchTarget) };
+		case 0x06: return { format("%-7s %s, 0x%08x", "blez", REG_LUT[rs], branchTarget) };
+		case 0x07: return { format("%-7s %s, 0x%08x", "bgtz", REG_LUT[rs], branchTarget) };
+		case 0x08: return immS("addi");
+		case 0x09: return immS("addiu");
+		case 0x0a: return immS("slti");
+		case 0x0b: return immS("sltiu");
+		case 0x0c: return immZ("andi");
+		case 0x0d: return immZ("ori");
+		case 0x0e: return immZ("xori");
+		case 0x0f: return { format("%-7s %s, 0x%x", "lui", REG_LUT[rt], zimm), Dest::RT };
+		case 0x10:
+		case 0x12:
+			if (opcode & (1 << 25)) {
+				if (primary == 0x10) {
+					return { (funct == 0x10) ? "rfe" : format("cop0    0x%07x", opcode & 0x1ff'ffff) };
+				}
+				return { GTE_COMMANDS[funct] ? GTE_COMMANDS[funct] : format("cop2    0x%07x", opcode & 0x1ff'ffff) };
+			}
+			switch (rs) {
+				case 0x00: return cop("mfc", rd, Dest::RT);
+				case 0x02: return cop("cfc", rd + 32, Dest::RT);
+				case 0x04: return cop("mtc", rd, Dest::None);
+				case 0x06: return cop("ctc", rd + 32, Dest::None);
+			}
+			break;
+		case 0x20: return load("lb");
+		case 0x21: return load("lh");
+		case 0x22: return load("lwl");
+		case 0x23: return load("lw");
+		case 0x24: return load("lbu");
+		case 0x25: return load("lhu");
+		case 0x26: return load("lwr");
+		case 0x28: return store("sb");
+		case 0x29: return store("sh");
+		case 0x2a: return store("swl");
+		case 0x2b: return store("sw");
+		case 0x2e: return store("swr");
+		case 0x32: return { format("%-7s cop2r%d, %d(%s)", "lwc2", rt, simm, REG_LUT[rs]) };
+		case 0x3a: return { format("%-7s cop2r%d, %d(%s)", "swc2", rt, simm, REG_LUT[rs]) };
+	}
+	return { format("illegal 0x%08x", opcode) };
+}
+
+int main(int argc, char* argv[]) {
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <trace file> [last N entries]\n", argv[0]);
+		return 1;
+	}
+
+	FILE* file = fopen(argv[1], "rb");
+	if (!file) {
+		fprintf(stderr, "Could not open %s\n", argv[1]);
+		return 1;
+	}
+
+	Trace::FileHeader header;
+	if (fread(&header, sizeof(header), 1, file) != 1 || header.magic != TRACE_MAGIC) {
+		fprintf(stderr, "%s is not a q00.psx trace\n", argv[1]);
+		return 1;
+	}
+	if (header.version != TRACE_VERSION || header.entrySize != sizeof(Trace::Entry)) {
+		fprintf(stderr, "Unsupported trace version %u\n", header.version);
+		return 1;
+	}
+
+	std::vector<Trace::Entry> entries(header.count);
+	const size_t read = fread(entries.data(), sizeof(Trace::Entry), entries.size(), file);
+	fclose(file);
+	entries.resize(read);
+
+	size_t first = 0;
+	if (argc > 2) {
+		const size_t last = strtoull(argv[2], nullptr, 0);
+		first = (last < entries.size()) ? entries.size() - last : 0;
+	}
+
+	//	index of the entry within the whole run
+	const u64 base = header.recorded - entries.size();
+	printf("; %llu instructions recorded, %zu in the trace\n", (unsigned long long)header.recorded, entries.size());
+
+	for (size_t i = first; i < entries.size(); i++) {
+		const Trace::Entry& entry = entries[i];
+		const Disassembly d = disassemble(entry.pc, entry.opcode);
+		const u8 rt = (entry.opcode >> 16) & 0x1f;
+		const u8 rd = (entry.opcode >> 11) & 0x1f;
+
+		std::string written;
+		switch (d.dest) {
+			case Dest::RT: if (rt) written = format("%s=%08x", REG_LUT[rt], entry.rt); break;
+			case Dest::RD: if (rd) written = format("%s=%08x", REG_LUT[rd], entry.rd); break;
+			case Dest::RA: written = format("ra=%08x", entry.pc + 8); break;
+			case Dest::None: break;
+		}
+
+		printf("%12llu  %08x  %08x  %-36s %s\n", (unsigned long long)(base + i), entry.pc, entry.opcode, d.text.c_str(), written.c_str());
+	}
+	return 0;
+}
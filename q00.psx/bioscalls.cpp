@@ -0,0 +1,377 @@
+#include "bioscalls.h"
+#include "cpu.h"
+#include "mmu.h"
+#include <algorithm>
+#include <iterator>
+#include <vector>
+#define CPU R3000A
+
+static auto console = spdlog::stdout_color_mt("BIOS");
+
+namespace BIOSCalls {
+
+	static const char* A_FUNC_LUT[] = {
+	"open(filename,accessmode)",
+	"lseek(fd,offset,seektype)",
+	"read(fd,dst,length)",
+	"write(fd,src,length)",
+	"close(fd)",
+	"ioctl(fd,cmd,arg)",
+	"exit(exitcode)",
+	"isatty(fd)",
+	"getc(fd)",
+	"putc(char,fd)",
+	"todigit(char)",
+	"atof(src)     ;Does NOT work - uses (ABSENT) cop1 !!!",
+	"strtoul(src,src_end,base)",
+	"strtol(src,src_end,base)",
+	"abs(val)",
+	"labs(val)",
+	"atoi(src)",
+	"atol(src)",
+	"atob(src,num_dst)",
+	"setjmp(buf)",
+	"longjmp(buf,param)",
+	"strcat(dst,src)",
+	"strncat(dst,src,maxlen)",
+	"strcmp(str1,str2)",
+	"strncmp(str1,str2,maxlen)",
+	"strcpy(dst,src)",
+	"strncpy(dst,src,maxlen)",
+	"strlen(src)",
+	"index(src,char)",
+	"rindex(src,char)",
+	"strchr(src,char)  ;exactly the same as 'index'",
+	"strrchr(src,char) ;exactly the same as 'rindex'",
+	"strpbrk(src,list)",
+	"strspn(src,list)",
+	"strcspn(src,list)",
+	"strtok(src,list)  ;use strtok(0,list) in further calls",
+	"strstr(str,substr)       ;Bugged",
+	"toupper(char)",
+	"tolower(char)",
+	"bcopy(src,dst,len)",
+	"bzero(dst,len)",
+	"bcmp(ptr1,ptr2,len)      ;Bugged",
+	"memcpy(dst,src,len)",
+	"memset(dst,fillbyte,len)",
+	"memmove(dst,src,len)     ;Bugged",
+	"memcmp(src1,src2,len)    ;Bugged",
+	"memchr(src,scanbyte,len)",
+	"rand()",
+	"srand(seed)",
+	"qsort(base,nel,width,callback)",
+	"strtod(src,src_end) ;Does NOT work - uses (ABSENT) cop1 !!!",
+	"malloc(size)",
+	"free(buf)",
+	"lsearch(key,base,nel,width,callback)",
+	"bsearch(key,base,nel,width,callback)",
+	"calloc(sizx,sizy)            ;SLOW!",
+	"realloc(old_buf,new_siz)     ;SLOW!",
+	"InitHeap(addr,size)",
+	"_exit(exitcode)",
+	"getchar()",
+	"putchar(char)",
+	"gets(dst)",
+	"puts(src)",
+	"printf(txt,param1,param2,etc.)",
+	"SystemErrorUnresolvedException()",
+	"LoadTest(filename,headerbuf)",
+	"Load(filename,headerbuf)",
+	"Exec(headerbuf,param1,param2)",
+	"FlushCache()",
+	"init_a0_b0_c0_vectors",
+	"GPU_dw(Xdst,Ydst,Xsiz,Ysiz,src)",
+	"gpu_send_dma(Xdst,Ydst,Xsiz,Ysiz,src)",
+	"SendGP1Command(gp1cmd)",
+	"GPU_cw(gp0cmd)   ;send GP0 command word",
+	"GPU_cwp(src,num) ;send GP0 command word and parameter words",
+	"send_gpu_linked_list(src)",
+	"gpu_abort_dma()",
+	"GetGPUStatus()",
+	"gpu_sync()",
+	"SystemError",
+	"SystemError",
+	"LoadExec(filename,stackbase,stackoffset)",
+	"GetSysSp",
+	"SystemError           ;PS2: set_ioabort_handler(src)",
+	"_96_init()",
+	"_bu_init()",
+	"_96_remove()  ;does NOT work due to SysDeqIntRP bug",
+	"return 0",
+	"return 0",
+	"return 0",
+	"return 0",
+	"dev_tty_init()                                      ;PS2: SystemError",
+	"dev_tty_open(fcb,and unused:'path/name',accessmode) ;PS2: SystemError",
+	"dev_tty_out(fcb,cmd)                             ;PS2: SystemError",
+	"dev_tty_ioctl(fcb,cmd,arg)                          ;PS2: SystemError",
+	"dev_cd_open(fcb,'path/name',accessmode)",
+	"dev_cd_read(fcb,dst,len)",
+	"dev_cd_close(fcb)",
+	"dev_cd_firstfile(fcb,'path/name',direntry)",
+	"dev_cd_nextfile(fcb,direntry)",
+	"dev_cd_chdir(fcb,'path')",
+	"dev_card_open(fcb,'path/name',accessmode)",
+	"dev_card_read(fcb,dst,len)",
+	"dev_card_write(fcb,src,len)",
+	"dev_card_close(fcb)",
+	"dev_card_firstfile(fcb,'path/name',direntry)",
+	"dev_card_nextfile(fcb,direntry)",
+	"dev_card_erase(fcb,'path/name')",
+	"dev_card_undelete(fcb,'path/name')",
+	"dev_card_format(fcb)",
+	"dev_card_rename(fcb1,'path/name1',fcb2,'path/name2')",
+	"?   ;card ;[r4+18h]=00000000h  ;card_clear_error(fcb) or so",
+	"_bu_init()",
+	"_96_init()",
+	"_96_remove()   ;does NOT work due to SysDeqIntRP bug",
+	"return 0",
+	"return 0",
+	"return 0",
+	"return 0",
+	"return 0",
+	"CdAsyncSeekL(src)",
+	"return 0               ;DTL-H: Unknown?",
+	"return 0               ;DTL-H: Unknown?",
+	"return 0               ;DTL-H: Unknown?",
+	"CdAsyncGetStatus(dst)",
+	"return 0               ;DTL-H: Unknown?",
+	"CdAsyncReadSector(count,dst,mode)",
+	"return 0               ;DTL-H: Unknown?",
+	"return 0               ;DTL-H: Unknown?",
+	"CdAsyncSetMode(mode)",
+	"return 0               ;DTL-H: Unknown?",
+	"return 0               ;DTL-H: Unknown?",
+	"return 0               ;DTL-H: Unknown?",
+	"return 0               ;DTL-H: Unknown?, or reportedly, CdStop (?)",
+	"return 0               ;DTL-H: Unknown?",
+	"return 0               ;DTL-H: Unknown?",
+	"return 0               ;DTL-H: Unknown?",
+	"return 0               ;DTL-H: Unknown?",
+	"return 0               ;DTL-H: Unknown?",
+	"return 0               ;DTL-H: Unknown?",
+	"return 0               ;DTL-H: Unknown?",
+	"return 0               ;DTL-H: Unknown?",
+	"return 0               ;DTL-H: Unknown?",
+	"return 0               ;DTL-H: Unknown?",
+	"CdromIoIrqFunc1()",
+	"CdromDmaIrqFunc1()",
+	"CdromIoIrqFunc2()",
+	"CdromDmaIrqFunc2()",
+	"CdromGetInt5errCode(dst1,dst2)",
+	"CdInitSubFunc()",
+	"AddCDROMDevice()",
+	"AddMemCardDevice()     ;DTL-H: SystemError",
+	"AddDuartTtyDevice()    ;DTL-H: AddAdconsTtyDevice ;PS2: SystemError",
+	"add_nullcon_driver()",
+	"SystemError            ;DTL-H: AddMessageWindowDevice",
+	"SystemError            ;DTL-H: AddCdromSimDevice",
+	"SetConf(num_EvCB,num_TCB,stacktop)",
+	"GetConf(num_EvCB_dst,num_TCB_dst,stacktop_dst)",
+	"SetCdromIrqAutoAbort(type,flag)",
+	"SetMem(megabytes)",
+	};
+	static const char* B_FUNC_LUT[] = {
+		"alloc_kernel_memory(size)",
+		"free_kernel_memory(buf)",
+		"init_timer(t,reload,flags)",
+		"get_timer(t)",
+		"enable_timer_irq(t)",
+		"disable_timer_irq(t)",
+		"restart_timer(t)",
+		"DeliverEvent(class, spec)",
+		"OpenEvent(class,spec,mode,func)",
+		"CloseEvent(event)",
+		"WaitEvent(event)",
+		"TestEvent(event)",
+		"EnableEvent(event)",
+		"DisableEvent(event)",
+		"OpenTh(reg_PC,reg_SP_FP,reg_GP)",
+		"CloseTh(handle)",
+		"ChangeTh(handle)",
+		"jump_to_00000000h",
+		"InitPAD2(buf1,siz1,buf2,siz2)",
+		"StartPAD2()",
+		"StopPAD2()",
+		"PAD_init2(type,button_dest,unused,unused)",
+		"PAD_dr()",
+		"ReturnFromException()",
+		"ResetEntryInt()",
+		"HookEntryInt(addr)",
+		"SystemError  ;PS2: return 0",
+		"SystemError  ;PS2: return 0",
+		"SystemError  ;PS2: return 0",
+		"SystemError  ;PS2: return 0",
+		"SystemError  ;PS2: return 0",
+		"SystemError  ;PS2: return 0",
+		"UnDeliverEvent(class,spec)",
+		"SystemError  ;PS2: return 0",
+		"SystemError  ;PS2: return 0",
+		"SystemError  ;PS2: return 0",
+		"jump_to_00000000h",
+		"jump_to_00000000h",
+		"jump_to_00000000h",
+		"jump_to_00000000h",
+		"jump_to_00000000h",
+		"jump_to_00000000h",
+		"SystemError  ;PS2: return 0",
+		"SystemError  ;PS2: return 0",
+		"jump_to_00000000h",
+		"jump_to_00000000h",
+		"jump_to_00000000h",
+		"jump_to_00000000h",
+		"jump_to_00000000h",
+		"jump_to_00000000h",
+		"open(filename,accessmode)",
+		"lseek(fd,offset,seektype)",
+		"read(fd,dst,length)",
+		"write(fd,src,length)",
+		"close(fd)",
+		"ioctl(fd,cmd,arg)",
+		"exit(exitcode)",
+		"isatty(fd)",
+		"getc(fd)",
+		"putc(char,fd)",
+		"getchar()",
+		"putchar(char)",
+		"gets(dst)",
+		"puts(src)",
+		"cd(name)",
+		"format(devicename)",
+		"firstfile2(filename,direntry)",
+		"nextfile(direntry)",
+		"rename(old_filename,new_filename)",
+		"erase(filename)",
+		"undelete(filename)",
+		"AddDrv(device_info)  ;subfunction for AddXxxDevice functions",
+		"DelDrv(device_name_lowercase)",
+		"PrintInstalledDevices()"
+	};
+	static const char* C_FUNC_LUT[] = {
+		"EnqueueTimerAndVblankIrqs(priority)",
+		"EnqueueSyscallHandler(priority)",
+		"EnqueueTimerAndVblankIrqs(priority) ;used with prio=1",
+		"EnqueueSyscallHandler(priority)     ;used with prio=0",
+		"SysEnqIntRP(priority,struc)  ;bugged, use with care",
+		"SysDeqIntRP(priority,struc)  ;bugged, use with care",
+		"get_free_EvCB_slot()",
+		"get_free_TCB_slot()",
+		"ExceptionHandler()",
+		"InstallExceptionHandlers()  ;destroys/uses k0/k1",
+		"SysInitMemory(addr,size)",
+		"SysInitKernelVariables()",
+		"ChangeClearRCnt(t,flag)",
+		"SystemError  ;PS2: return 0",
+		"InitDefInt(priority) ;used with prio=3",
+		"SetIrqAutoAck(irq,flag)",
+		"return 0               ;DTL-H2000: dev_sio_init",
+		"return 0               ;DTL-H2000: dev_sio_open",
+		"return 0               ;DTL-H2000: dev_sio_out",
+		"return 0               ;DTL-H2000: dev_sio_ioctl",
+		"InstallDevices(ttyflag)",
+		"FlushStdInOutPut()",
+		"return 0               ;DTL-H2000: SystemError",
+		"_cdevinput(circ,char)",
+		"_cdevscan()",
+		"_circgetc(circ)    ;uses r5 as garbage txt for _ioabort",
+		"_circputc(char,circ)",
+		"_ioabort(txt1,txt2)",
+		"set_card_find_mode(mode)  ;0=normal, 1=find deleted files",
+		"KernelRedirect(ttyflag)   ;PS2: ttyflag=1 causes SystemError",
+		"AdjustA0Table()",
+		"get_card_find_mode()"
+	};
+
+	bool profile = false;
+	thread_local word pendingReturn = BIOS_CALL_NO_RETURN;
+
+	struct Counter {
+		u64 calls;
+		u64 cycles;
+	};
+
+	struct Pending {
+		word returnAddress;
+		u8 table;				//	0 / 1 / 2 for A / B / C
+		u8 id;
+		u64 start;
+	};
+
+	thread_local Counter counters[3][0x100];
+	thread_local Pending pending[BIOS_CALL_DEPTH];
+	thread_local u32 depth = 0;
+
+	const char* name(u8 table, u8 id) {
+		switch (table) {
+			case 0: return id < std::size(A_FUNC_LUT) ? A_FUNC_LUT[id] : "?";
+			case 1: return id < std::size(B_FUNC_LUT) ? B_FUNC_LUT[id] : "?";
+			default: return id < std::size(C_FUNC_LUT) ? C_FUNC_LUT[id] : "?";
+		}
+	}
+}
+
+void BIOSCalls::call(word address) {
+	const u8 id = CPU::registers.r[9];
+	const u8 table = (address - 0xa0) >> 4;
+
+	//	putchar
+	if ((address == 0xa0 && id == 0x3c) || (address == 0xb0 && id == 0x3d)) {
+		if (Memory::ttyOutput) {
+			Memory::ttyOutput->push_back((char)CPU::registers.r[4]);
+		}
+		else {
+			printf("%c", CPU::registers.r[4]);
+		}
+	}
+	else if (SHOW_BIOS_FUNCTIONS) {
+		console->info("{0:c}-Function ({1:x}) - {2:s}", (char)('A' + table), id, name(table, id));
+	}
+
+	if (!profile) {
+		return;
+	}
+	counters[table][id].calls++;
+	if (depth == BIOS_CALL_DEPTH) {
+		std::copy(pending + 1, pending + depth, pending);
+		depth--;
+	}
+	pending[depth++] = { MASKED_ADDRESS(CPU::registers.r[31]), table, id, CPU::cycles };
+	pendingReturn = pending[depth - 1].returnAddress;
+}
+
+void BIOSCalls::returned() {
+	const Pending& call = pending[--depth];
+	counters[call.table][call.id].cycles += CPU::cycles - call.start;
+	pendingReturn = depth ? pending[depth - 1].returnAddress : BIOS_CALL_NO_RETURN;
+}
+
+//	functions by the guest cycles spent in them, then by calls
+void BIOSCalls::printProfile() {
+	struct Entry {
+		u8 table;
+		u8 id;
+		Counter counter;
+	};
+	std::vector<Entry> entries;
+	for (u8 table = 0; table < 3; table++) {
+		for (u32 id = 0; id < 0x100; id++) {
+			if (counters[table][id].calls) {
+				entries.push_back({ table, (u8)id, counters[table][id] });
+			}
+		}
+	}
+	std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+		if (a.counter.cycles != b.counter.cycles) {
+			return a.counter.cycles > b.counter.cycles;
+		}
+		return a.counter.calls > b.counter.calls;
+	});
+
+	console->info("BIOS calls ({0:d} functions, {1:d} cycles total):", entries.size(), CPU::cycles);
+	for (const Entry& entry : entries) {
+		const double share = CPU::cycles ? 100.0 * entry.counter.cycles / CPU::cycles : 0.0;
+		console->info("  {0:c}({1:02x}) {2:>10d} calls {3:>12d} cycles {4:5.1f}%  {5:s}", (char)('A' + entry.table), entry.id,
+			entry.counter.calls, entry.counter.cycles, share, name(entry.table, entry.id));
+	}
+}
@@ -0,0 +1,40 @@
+#pragma once
+#ifndef BIOSCALLS_GUARD
+#define BIOSCALLS_GUARD
+#include "defs.h"
+#define MASKED_ADDRESS(a) (a & 0x1fff'ffff)
+#define SHOW_BIOS_FUNCTIONS false
+#define BIOS_CALL_DEPTH 16			//	pending calls the profiler waits for, the oldest are dropped when it's full
+#define BIOS_CALL_NO_RETURN 1		//	never a valid pc
+
+/*
+	BIOS kernel calls (A0h / B0h / C0h functions, function id in r9).
+	Every engine passes pc in here before it runs an instruction / block, so a call is seen
+	once, when it jumps to the thunk, and never on data reads of the thunk area.
+	putchar goes to the TTY. With --profile-bios every call is counted and the guest cycles
+	until it comes back to ra (nested calls included) are charged to it, the report is printed
+	at exit. Calls that never come back (exit, ReturnFromException, ..) are only counted.
+	Without it pendingReturn stays at BIOS_CALL_NO_RETURN, so all this costs is the compare
+	that used to sit in Memory::fetch.
+*/
+namespace BIOSCalls {
+
+	extern bool profile;
+	extern thread_local word pendingReturn;		//	masked ra of the innermost call the profiler waits for
+
+	void call(word address);
+	void returned();
+	void printProfile();
+
+	inline void enter(word pc) {
+		const word address = MASKED_ADDRESS(pc);
+		if (address == 0xa0 || address == 0xb0 || address == 0xc0) {
+			call(address);
+		}
+		else if (address == pendingReturn) {
+			returned();
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,294 @@
+#include "blockcache.h"
+#include "mmu.h"
+#include "recompiler.h"
+#include "debugger.h"
+#include <unordered_map>
+#include <algorithm>
+#include "include/spdlog/spdlog.h"
+#include "include/spdlog/sinks/stdout_color_sinks.h"
+
+static auto console = spdlog::stdout_color_mt("BlockCache");
+
+namespace BlockCache {
+	thread_local u64 codePages[BITMAP_WORDS(BLOCK_CACHE_PAGE_COUNT)] = { 0 };
+
+	thread_local std::unordered_map<word, Block*> blocks;
+	thread_local Block* recentBlocks[BLOCK_CACHE_RECENT_SIZE] = { nullptr };	//	direct mapped, in front of the hash map
+	thread_local std::unordered_map<u32, std::vector<Block*>> pageBlocks;
+
+	//	invalidated blocks might still be executing, so they only get freed on the next lookup
+	thread_local std::vector<Block*> retired;
+
+	Block* compile(word address);
+	bool isIdleCandidate(const Block* block);
+	void retire(Block* block, u32 invalidatedPage);
+}
+
+void BlockCache::init() {
+	console->info("BlockCache init");
+	flush();
+}
+
+BlockCache::Block* BlockCache::compile(word address) {
+	Block* block = new Block();
+	block->address = address;
+
+	word pc = address;
+	bool inDelaySlot = false;
+	word opcode;
+	//	a branch at the size limit still gets its delay slot, no block may start in one
+	while ((block->instructions.size() < BLOCK_CACHE_MAX_INSTRUCTIONS || inDelaySlot) && Memory::fetchInstruction(pc, opcode)) {
+
+		//	a breakpoint starts a block of its own (unless it's in a delay slot)
+		if (Debugger::breaking && pc != address && !inDelaySlot && Debugger::isBreakpoint(pc)) {
+			break;
+		}
+		const R3000A::Instruction instr = R3000A::decode(opcode);
+		block->instructions.push_back(instr);
+		pc += 4;
+
+		if (inDelaySlot || instr.ends_block) {
+			break;
+		}
+		inDelaySlot = instr.has_delay_slot;
+	}
+	block->size = pc - address;
+	block->idle_candidate = isIdleCandidate(block);
+	block->breakpoint = Debugger::breaking && Debugger::isBreakpoint(address);
+	IR::build(block);
+
+	//	remember which pages this block was built from, so writes to them can throw it away
+	for (word at = address & ~(BLOCK_CACHE_PAGE_SIZE - 1); at < pc; at += BLOCK_CACHE_PAGE_SIZE) {
+		const u32 page = BLOCK_CACHE_PAGE(at);
+		if (!isCodePage(page)) {
+			BITMAP_SET(codePages, page);
+			Memory::updatePage(page);
+		}
+		pageBlocks[page].push_back(block);
+	}
+
+	return block;
+}
+
+//	reads that don't change anything: memory and the status registers polling loops wait on.
+//	GPUREAD, the timer modes (reading clears the reached flags), FIFOs, .. aren't
+static bool isPureLoad(word address) {
+	if (SCRATCHPAD_ACCESS(address)) {
+		return true;
+	}
+	address = MASKED_ADDRESS(address);
+	if (address < RAM_MIRRORS_END) {
+		return true;
+	}
+	if (address >= 0x1f80'1080 && address < 0x1f80'10f0) {
+		return (address & 0xc) == 0x8;		//	DMA channel control
+	}
+	if (address >= 0x1f80'1100 && address < 0x1f80'1130) {
+		return (address & 0xc) != 0x4;		//	timer current value / target
+	}
+	switch (address) {
+		case 0x1f80'1070:		//	I_STAT
+		case 0x1f80'1074:		//	I_MASK
+		case 0x1f80'10f0:		//	DMA control
+		case 0x1f80'10f4:		//	DMA interrupt
+		case 0x1f80'1814:		//	GPUSTAT
+		case 0x1f80'1daa:		//	SPUCNT
+		case 0x1f80'1dae:		//	SPUSTAT
+			return true;
+	}
+	return false;
+}
+
+/*
+	A block only made of loads, register ops and a branch back to its own start can't
+	change anything but registers. If an iteration leaves them as they were, the loop
+	is waiting for the hardware (polling GPUSTAT, I_STAT, timers, ..).
+	Loads have to be from addresses known when compiling (the base built in the block
+	by LUI / ORI / ADDIU ..) that reading doesn't change, see isPureLoad.
+*/
+bool BlockCache::isIdleCandidate(const Block* block) {
+	const size_t count = block->instructions.size();
+	if (count < 2 || !block->instructions[count - 2].has_delay_slot) {
+		return false;
+	}
+
+	//	registers with a value known when compiling, r0 always is
+	u32 known = 1;
+	word values[32] = { 0 };
+
+	for (size_t i = 0; i < count; i++) {
+		const R3000A::Instruction& instr = block->instructions[i];
+		const word opcode = instr.opcode;
+		const u8 primary = opcode >> 26;
+		const word address = block->address + 4 * (word)i;
+
+		//	the loop branch itself
+		if (i == count - 2) {
+			word target;
+			if (primary == 0x02) {
+				target = R3000A::jumpTarget(address, instr);
+			}
+			else if (primary == 0x01 || (primary >= 0x04 && primary <= 0x07)) {
+				target = address + 4 + ((word)SIGN_EXT32(instr.imm16) << 2);
+			}
+			else {
+				return false;
+			}
+			if (target != block->address) {
+				return false;
+			}
+			known &= ~(1u << 31);		//	BLTZAL / BGEZAL link
+			continue;
+		}
+
+		//	SPECIAL: shifts, HI / LO, MULT / DIV, ALU ops
+		if (primary == 0x00) {
+			const u8 funct = opcode & 0x3f;
+			const bool pure = (funct <= 0x07 && funct != 0x01 && funct != 0x05) ||
+				(funct >= 0x10 && funct <= 0x13) || (funct >= 0x18 && funct <= 0x1b) ||
+				(funct >= 0x20 && funct <= 0x27) || funct == 0x2a || funct == 0x2b;
+			if (!pure) {
+				return false;
+			}
+			known &= ~(1u << instr.rd);
+		}
+		//	ALU immediates
+		else if (primary >= 0x08 && primary <= 0x0f) {
+			const bool base = (known >> instr.rs) & 1;
+			const word rs = values[instr.rs];
+			bool folded = true;
+			switch (primary) {
+				case 0x09: values[instr.rt] = rs + (word)SIGN_EXT32(instr.imm16); folded = base; break;
+				case 0x0d: values[instr.rt] = rs | (u16)instr.imm16; folded = base; break;
+				case 0x0f: values[instr.rt] = (word)(u16)instr.imm16 << 16; break;
+				default: folded = false; break;
+			}
+			if (folded) {
+				known |= 1u << instr.rt;
+			}
+			else {
+				known &= ~(1u << instr.rt);
+			}
+		}
+		//	loads
+		else if (primary >= 0x20 && primary <= 0x26) {
+			if (!((known >> instr.rs) & 1) || !isPureLoad(values[instr.rs] + (word)SIGN_EXT32(instr.imm16))) {
+				return false;
+			}
+			known &= ~(1u << instr.rt);
+		}
+		else {
+			return false;
+		}
+		known |= 1;
+		values[0] = 0;
+	}
+	return true;
+}
+
+BlockCache::Block* BlockCache::lookup(word address) {
+	if (!retired.empty()) {
+		for (Block* block : retired) {
+			delete block;
+		}
+		retired.clear();
+	}
+
+	Block*& recent = recentBlocks[BLOCK_CACHE_RECENT_INDEX(address)];
+	if (recent && recent->address == address) {
+		return recent;
+	}
+
+	auto it = blocks.find(address);
+	if (it != blocks.end()) {
+		recent = it->second;
+		return recent;
+	}
+
+	Block* block = compile(address);
+	blocks[address] = block;
+	recent = block;
+	return block;
+}
+
+void BlockCache::retire(Block* block, u32 invalidatedPage) {
+	block->valid = false;
+	Recompiler::unlink(block);
+
+	auto it = blocks.find(block->address);
+	if (it != blocks.end() && it->second == block) {
+		blocks.erase(it);
+	}
+	if (recentBlocks[BLOCK_CACHE_RECENT_INDEX(block->address)] == block) {
+		recentBlocks[BLOCK_CACHE_RECENT_INDEX(block->address)] = nullptr;
+	}
+
+	//	blocks spanning a page boundary are also listed on the other page
+	for (word at = block->address & ~(BLOCK_CACHE_PAGE_SIZE - 1); at < block->address + block->size; at += BLOCK_CACHE_PAGE_SIZE) {
+		const u32 page = BLOCK_CACHE_PAGE(at);
+		if (page == invalidatedPage) {
+			continue;
+		}
+		auto pit = pageBlocks.find(page);
+		if (pit != pageBlocks.end()) {
+			std::vector<Block*>& list = pit->second;
+			list.erase(std::remove(list.begin(), list.end(), block), list.end());
+			if (list.empty()) {
+				BITMAP_CLEAR(codePages, page);
+				Memory::updatePage(page);
+				pageBlocks.erase(pit);
+			}
+		}
+	}
+
+	retired.push_back(block);
+}
+
+void BlockCache::invalidatePage(u32 page) {
+	auto it = pageBlocks.find(page);
+	if (it != pageBlocks.end()) {
+		std::vector<Block*> list = std::move(it->second);
+		pageBlocks.erase(it);
+		for (Block* block : list) {
+			retire(block, page);
+		}
+	}
+	BITMAP_CLEAR(codePages, page);
+	Memory::updatePage(page);
+}
+
+void BlockCache::invalidateRange(word address, word size) {
+	if (size == 0) {
+		return;
+	}
+	for (u32 page = BLOCK_CACHE_PAGE(address); page <= BLOCK_CACHE_PAGE(address + size - 1); page++) {
+		if (isCodePage(page)) {
+			invalidatePage(page);
+		}
+	}
+}
+
+void BlockCache::flush() {
+	for (auto& entry : blocks) {
+		entry.second->valid = false;
+		Recompiler::unlink(entry.second);
+		retired.push_back(entry.second);
+	}
+	blocks.clear();
+	pageBlocks.clear();
+	memset(recentBlocks, 0, sizeof(recentBlocks));
+	for (u32 page = 0; page < BLOCK_CACHE_PAGE_COUNT; page++) {
+		if (isCodePage(page)) {
+			BITMAP_CLEAR(codePages, page);
+			Memory::updatePage(page);
+		}
+	}
+}
+
+void BlockCache::shutdown() {
+	flush();
+	for (Block* block : retired) {
+		delete block;
+	}
+	retired.clear();
+}
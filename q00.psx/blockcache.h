@@ -0,0 +1,62 @@
+#pragma once
+#ifndef BLOCKCACHE_GUARD
+#define BLOCKCACHE_GUARD
+#include "defs.h"
+#include "cpu.h"
+#include "ir.h"
+#include <vector>
+#define BLOCK_CACHE_PAGE_SIZE 0x1000
+#define BLOCK_CACHE_PAGE(a) ((((a) & 0x1fff'ffff) < 0x80'0000 ? ((a) & 0x1f'ffff) : ((a) & 0x1fff'ffff)) >> 12)	//	RAM mirrors share the pages of RAM
+#define BLOCK_CACHE_PAGE_COUNT (0x2000'0000 / BLOCK_CACHE_PAGE_SIZE)
+#define BLOCK_CACHE_MAX_INSTRUCTIONS 64		//	plus the delay slot of a branch right at the limit
+#define BLOCK_CACHE_RECENT_SIZE 0x1000
+#define BLOCK_CACHE_RECENT_INDEX(a) ((a >> 2) & (BLOCK_CACHE_RECENT_SIZE - 1))
+
+namespace BlockCache {
+
+	struct Block;
+
+	//	recompiled jump from the end of one block straight into the next one
+	struct Link {
+		u8* jump = nullptr;		//	rel32 of the jmp, points at stub while unlinked
+		u8* stub = nullptr;		//	returns to the dispatcher, asking it to patch the jmp
+		word target = 0;
+		Block* from = nullptr;
+		Block* to = nullptr;
+	};
+
+	/*
+		A block is a straight run of guest instructions, starting at the address
+		it was entered at and ending after the delay slot of the first jump / branch
+		(or after an instruction that may throw / leave the block otherwise).
+	*/
+	struct Block {
+		word address;
+		word size;			//	in bytes
+		bool valid = true;	//	cleared when the RAM behind it gets written
+		std::vector<R3000A::Instruction> instructions;
+		std::vector<IR::Op> ir;			//	what the cached interpreter / the recompiler actually run
+		void* code = nullptr;	//	host code, if the recompiler translated this block
+		u8* body = nullptr;		//	host code after the prologue, where linked blocks jump to
+		Link links[2];			//	static successors (branch taken / not taken)
+		std::vector<Link*> incoming;	//	links of other blocks currently patched to this one
+		bool idle_candidate = false;	//	side-effect free loop back to its own start (polling loop)
+		bool breakpoint = false;		//	starts at a Debugger breakpoint, checked on every entry
+	};
+
+	//	pages (BLOCK_CACHE_PAGE) that have at least one block compiled from them, one bit each
+	extern thread_local u64 codePages[BITMAP_WORDS(BLOCK_CACHE_PAGE_COUNT)];
+
+	inline bool isCodePage(u32 page) {
+		return BITMAP_TEST(codePages, page);
+	}
+
+	void init();
+	Block* lookup(word address);
+	void invalidatePage(u32 page);
+	void invalidateRange(word address, word size);
+	void flush();
+	void shutdown();
+}
+
+#endif
@@ -1,19 +1,27 @@
 #include "mmu.h"
 #include "cpu.h"
 #include "ui.h"
+#include "gte.h"
+#include "recompiler.h"
+#include "hle.h"
+#include "bioscalls.h"
+#include "trace.h"
+#include "lockstep.h"
+#include "debugger.h"
 #include <stdint.h>
 #include <sstream>
 #include <stdio.h>
 #include <iostream>
+#include <array>
+#include <string.h>
 #include "include/spdlog/spdlog.h"
 #include "include/spdlog/sinks/stdout_color_sinks.h"
 #include "include/spdlog/pattern_formatter.h"
 #define DEBUG 0
 #define CPU R3000A
 #define REG(a) REG_LUT[a]
-#define PRIMARY_OPCODE(opcode) opcode >> 26
-#define SECONDARY_OPCODE(opcode) opcode & 0x3f
-#define COP_COMMAND(opcode) opcode & 0x4000'0000
+#define PRIMARY_OPCODE(opcode) (opcode >> 26)
+#define SECONDARY_OPCODE(opcode) (opcode & 0x3f)
 #define SYSERROR_UNRESOLVED_EXCEPTION 0x0000'0040
 #define EXC_VEC_RESET_BEV0 0xbfc0'0000
 #define EXC_VEC_RESET_BEV1 0xbfc0'0000
@@ -24,20 +32,40 @@
 #define EXC_VEC_GENERAL_BEV0 0x8000'0080
 #define EXC_VEC_GENERAL_BEV1 0xbfc0'0180
 
+//	cycle cost model (no cache / bus timing, just the usual averages)
+#define CYCLES_DEFAULT 1
+#define CYCLES_LOAD 2		//	includes the load delay slot
+#define CYCLES_MULT 9
+#define CYCLES_DIV 36
+
 using namespace R3000A;
 static auto console = spdlog::stdout_color_mt("CPU");
 
 namespace CPU {
-	Registers registers;
-	COP cop[4];
+	thread_local Registers registers;
+	thread_local COP cop[4];
+
+	thread_local Engine engine = Engine::CachedInterpreter;
+	thread_local u64 cycles = 0;
+	thread_local u64 nextEventCycle = 0;
+	thread_local IdleLoopStats idleLoopStats;
+
+	//	last idle loop candidate and the registers it was entered with
+	thread_local const BlockCache::Block* idleBlock = nullptr;
+	thread_local u32 idleSnapshot[34];
 
 	void writeCOPReg(u8 cop_id, u8 reg_id, u32 data) {
 		switch (cop_id) {
 		case 0:
 			switch (reg_id) {
-			case 12:
+			case 12: {
+				const bool isolated = cop[0].sr.flags.isolate_cache;
 				cop[0].sr.raw = data;
+				if (cop[0].sr.flags.isolate_cache != isolated) {
+					Memory::isolateCache(cop[0].sr.flags.isolate_cache);
+				}
 				break;
+			}
 			case 13:
 				cop[0].cause.raw = data;
 				break;
@@ -50,8 +78,7 @@ namespace CPU {
 			}
 			break;
 		case 2:
-			console->error("Unimplemented COP register write. COP: {0:x}, reg: {1:x} ", cop_id, reg_id);
-			exit(1);
+			GTE::writeData(reg_id, data);
 			break;
 		default:
 			console->error("Write to invalid COP register. COP: {0:x}, reg: {1:x} ", cop_id, reg_id);
@@ -77,6 +104,8 @@ namespace CPU {
 						return cop[0].r[reg_id];
 						break;
 				}
+			case 2:
+				return GTE::readData(reg_id);
 			default:
 				console->error("Unimplemented COP {0:x} reg {1:x} access", cop_id, reg_id);
 				break;
@@ -319,7 +348,7 @@ void Opcode_XOR(byte rd, byte rs, byte rt) {
 }
 
 void Opcode_XORI(byte rt, byte rs, u16 imm) {
-	CPU::registers.r[rt] = CPU::registers.r[rt] ^ imm;
+	CPU::registers.r[rt] = CPU::registers.r[rs] ^ imm;
 	CPU::registers.r[0] = 0;
 }
 
@@ -462,6 +491,34 @@ void COP_Opcode_MFC(byte rt, byte rd, byte cop) {
 	CPU::registers.r[0] = 0;
 }
 
+//	control registers only exist on the GTE
+void COP_Opcode_CFC(byte rt, byte rd, byte cop) {
+	if (cop != 2) {
+		console->info("CFCn {0:x}", cop);
+		exit(1);
+	}
+	CPU::registers.r[rt] = GTE::readControl(rd);
+	CPU::registers.r[0] = 0;
+}
+
+void COP_Opcode_CTC(byte rt, byte rd, byte cop) {
+	if (cop != 2) {
+		console->info("CTCn {0:x}", cop);
+		exit(1);
+	}
+	GTE::writeControl(rd, CPU::registers.r[rt]);
+}
+
+void Opcode_LWC2(byte rt, i16 offset, byte base) {
+	word vAddr = SIGN_EXT32(offset) + CPU::registers.r[base];
+	GTE::writeData(rt, Memory::fetch<word>(vAddr));
+}
+
+void Opcode_SWC2(byte rt, i16 offset, byte base) {
+	word vAddr = SIGN_EXT32(offset) + CPU::registers.r[base];
+	Memory::store<word>(vAddr, GTE::readData(rt));
+}
+
 void COP_Opcode_SYSCALL() {
 	CPU::writeCOPReg(0, 14, CPU::registers.pc);
 	CPU::registers.pc = (CPU::cop[0].sr.flags.boot_exception_vectors) ? EXC_VEC_GENERAL_BEV1 : EXC_VEC_GENERAL_BEV0;
@@ -477,146 +534,365 @@ void COP_Opcode_RFE() {
 }
 
 
-void CPU::step() {
+/*
+	Enters the general exception vector for the instruction at log_pc.
+	pc has to be advanced already, it only differs from log_pc + 4 inside a branch delay slot.
+*/
+void CPU::raiseException(u8 excode) {
+	const bool inDelaySlot = CPU::registers.pc != CPU::registers.log_pc + 4;
+	COP& cop0 = CPU::cop[0];
+	cop0.epc = inDelaySlot ? CPU::registers.log_pc - 4 : CPU::registers.log_pc;
+	cop0.cause.excode = excode;
+	cop0.cause.branch_delay = inDelaySlot;
 
-	CPU::registers.log_pc = CPU::registers.pc;
-	const word opcode = Memory::fetch<word>(CPU::registers.pc);
+	//	push the interrupt enable / kernel mode stack
+	cop0.sr.raw = (cop0.sr.raw & ~0x3f) | ((cop0.sr.raw << 2) & 0x3c);
 
-	//	branch delay slot
+	CPU::registers.pc = (cop0.sr.flags.boot_exception_vectors) ? EXC_VEC_GENERAL_BEV1 : EXC_VEC_GENERAL_BEV0;
+	CPU::registers.next_pc = CPU::registers.pc + 4;
+}
+
+//	pc points somewhere code can't be fetched from (I/O, scratchpad, unmapped), returns the cycles used
+u32 CPU::instructionBusError() {
+	console->warn("Instruction fetch from {0:08x}", CPU::registers.pc);
+
+	CPU::registers.log_pc = CPU::registers.pc;
 	CPU::registers.pc = CPU::registers.next_pc;
 	CPU::registers.next_pc += 4;
+	raiseException(COP::cause_IBE);
+
+	CPU::cycles += CYCLES_DEFAULT;
+	return CYCLES_DEFAULT;
+}
+
+//	Reserved Instruction exception, for every opcode slot the R3000A doesn't know
+void Opcode_ReservedInstruction(const Instruction& instr) {
+	console->warn("Reserved instruction {0:08x}", instr.opcode);
+	CPU::raiseException(COP::cause_RI);
+}
+
+
+/*
+	Opcode tables, generated at compile time.
+	Every slot either holds a handler, or points to a secondary table that gets indexed
+	by another field of the opcode (SPECIAL by funct, COPn by rs, COPn commands by funct).
+	Empty slots raise a Reserved Instruction exception.
+*/
+namespace {
+	struct OpcodeInfo {
+		Handler handler = Opcode_ReservedInstruction;
+		bool has_delay_slot = false;
+		bool ends_block = true;
+		u8 cycles = CYCLES_DEFAULT;
+		const OpcodeInfo* table = nullptr;
+		u8 shift = 0;
+		u8 mask = 0;
+	};
+	typedef std::array<OpcodeInfo, 64> OpcodeTable;
+
+	constexpr OpcodeInfo op(Handler handler, u8 cycles = CYCLES_DEFAULT) { return { handler, false, false, cycles }; }
+	constexpr OpcodeInfo branch(Handler handler) { return { handler, true, false, CYCLES_DEFAULT }; }
+	constexpr OpcodeInfo endsBlock(Handler handler) { return { handler, false, true, CYCLES_DEFAULT }; }
+	constexpr OpcodeInfo sub(const OpcodeTable& table, u8 shift, u8 mask) { return { nullptr, false, false, 0, table.data(), shift, mask }; }
+
+	constexpr OpcodeTable makeSpecialTable() {
+		OpcodeTable t{};
+		t[0x00] = op([](const Instruction& i) { Opcode_SLL(i.rd, i.rt, i.imm5); });
+		t[0x02] = op([](const Instruction& i) { Opcode_SRL(i.rd, i.rt, i.imm5); });
+		t[0x03] = op([](const Instruction& i) { Opcode_SRA(i.rd, i.rt, i.imm5); });
+		t[0x04] = op([](const Instruction& i) { Opcode_SLLV(i.rd, i.rt, i.rs); });
+		t[0x06] = op([](const Instruction& i) { Opcode_SRLV(i.rd, i.rt, i.rs); });
+		t[0x07] = op([](const Instruction& i) { Opcode_SRAV(i.rd, i.rt, i.rs); });
+		t[0x08] = branch([](const Instruction& i) { Opcode_JR(i.rs); });
+		t[0x09] = branch([](const Instruction& i) { Opcode_JALR(i.rd, i.rs); });
+		t[0x0c] = endsBlock([](const Instruction&) { COP_Opcode_SYSCALL(); });
+		t[0x0d] = endsBlock([](const Instruction& i) { console->error("Unimplemented primary opcode 0x{0:02x}, secondary opcode {1:02x}", PRIMARY_OPCODE(i.opcode), SECONDARY_OPCODE(i.opcode)); exit(1); });
+		t[0x10] = op([](const Instruction& i) { Opcode_MFHI(i.rd); });
+		t[0x11] = op([](const Instruction& i) { Opcode_MTHI(i.rs); });
+		t[0x12] = op([](const Instruction& i) { Opcode_MFLO(i.rd); });
+		t[0x13] = op([](const Instruction& i) { Opcode_MTLO(i.rs); });
+		t[0x18] = op([](const Instruction& i) { Opcode_MULT(i.rs, i.rt); }, CYCLES_MULT);
+		t[0x19] = op([](const Instruction& i) { Opcode_MULTU(i.rs, i.rt); }, CYCLES_MULT);
+		t[0x1a] = op([](const Instruction& i) { Opcode_DIV(i.rs, i.rt); }, CYCLES_DIV);
+		t[0x1b] = op([](const Instruction& i) { Opcode_DIVU(i.rs, i.rt); }, CYCLES_DIV);
+		t[0x20] = op([](const Instruction& i) { Opcode_ADD(i.rd, i.rs, i.rt); });
+		t[0x21] = op([](const Instruction& i) { Opcode_ADDU(i.rs, i.rt, i.rd); });
+		t[0x22] = op([](const Instruction& i) { Opcode_SUB(i.rd, i.rs, i.rt); });
+		t[0x23] = op([](const Instruction& i) { Opcode_SUBU(i.rd, i.rs, i.rt); });
+		t[0x24] = op([](const Instruction& i) { Opcode_AND(i.rd, i.rs, i.rt); });
+		t[0x25] = op([](const Instruction& i) { Opcode_OR(i.rd, i.rs, i.rt); });
+		t[0x26] = op([](const Instruction& i) { Opcode_XOR(i.rd, i.rs, i.rt); });
+		t[0x27] = op([](const Instruction& i) { Opcode_NOR(i.rd, i.rs, i.rt); });
+		t[0x2a] = op([](const Instruction& i) { Opcode_SLT(i.rd, i.rs, i.rt); });
+		t[0x2b] = op([](const Instruction& i) { Opcode_SLTU(i.rd, i.rs, i.rt); });
+		return t;
+	}
 
-	//	decode the opcode
-	const u8 rs = (opcode >> 21) & 0x1f;	//	base
-	const u8 rt = (opcode >> 16) & 0x1f;
-	const u8 rd = (opcode >> 11) & 0x1f;
-	const u8 imm5 = (opcode >> 6) & 0x1f;
-	const u32 imm26 = opcode & 0x3ff'ffff;
-	const i16 imm16 = opcode & 0xffff;		//	offset
-
-	//	COP
-	if (COP_COMMAND(opcode)) {
-		const u8 top6 = PRIMARY_OPCODE(opcode);
-		const u8 top3 = top6 >> 3;
-		const u8 COP_ID = top6 & 0b11;
-
-		if (!(SECONDARY_OPCODE(opcode))) {
-			switch (rs) {
-				case 0x0: COP_Opcode_MFC(rt, rd, COP_ID); break;
-				case 0x2: console->info("CFCn {0:x}", COP_ID); exit(1); break;
-				case 0x4: COP_Opcode_MTC(rt, rd, COP_ID); break;
-				case 0x6: console->info("CTCn {0:x}", COP_ID); exit(1); break;
-				case 0x8:
-					switch (rt) {
-						case 0x00: console->info("BCnF {0:x}", COP_ID); exit(1); break;
-						case 0x01: console->info("BCnT {0:x}", COP_ID); exit(1); break;
-					}
-					break;
-				default:
-					console->error("Illegal COP command {0:x}", opcode);
-					exit(1);
-					break;
-			}
+	//	COP0 commands (rs >= 0x10), indexed by funct. No TLB on the PSX, so only RFE
+	constexpr OpcodeTable makeCOP0CommandTable() {
+		OpcodeTable t{};
+		t[0x10] = endsBlock([](const Instruction&) { COP_Opcode_RFE(); });
+		return t;
+	}
+
+	//	COP2 (GTE) commands, the GTE decodes funct itself
+	constexpr OpcodeTable makeCOP2CommandTable() {
+		OpcodeTable t{};
+		for (u8 funct = 0; funct < 64; funct++) {
+			t[funct] = op([](const Instruction& i) { GTE::command(i.opcode); }, GTE::COMMAND_CYCLES[funct]);
 		}
-		else {
-			switch (top3) {
-				case 0x2:
-					switch (SECONDARY_OPCODE(opcode)) {
-					case 0x01: console->info("COP0 TLBR (illegal)"); exit(1); break;
-					case 0x02: console->info("COP0 TLBWI (illegal)"); exit(1); break;
-					case 0x06: console->info("COP0 TLBWR (illegal)"); exit(1); break;
-					case 0x08: console->info("COP0 TLBP (illegal)"); exit(1); break;
-					case 0x10: COP_Opcode_RFE(); break;
-					}
-					break;
-				case 0x6:
-					console->info("LWCn RFE {0:x}", COP_ID); exit(1); break;
-					break;
-				case 0x7:
-					console->info("SWCn RFE {0:x}", COP_ID); exit(1); break;
-					break;
-				default:
-					console->error("Illegal COP command {0:x}", opcode);
-					exit(1);
-					break;
-			}
-		} 
+		return t;
 	}
-	//	CPU
-	else {
-		switch (PRIMARY_OPCODE(opcode)) {
 
-			//	SPECIAL
-		case 0x00: {
-			switch (SECONDARY_OPCODE(opcode)) {
-
-			case 0x00: opcode == 0 ? Opcode_NOP() : Opcode_SLL(rd, rt, imm5); break;
-			case 0x02: Opcode_SRL(rd, rt, imm5);  break;
-			case 0x03: Opcode_SRA(rd, rt, imm5); break;
-			case 0x04: Opcode_SLLV(rd, rt, rs); break;
-			case 0x06: Opcode_SRLV(rd, rt, rs);  break;
-			case 0x07: Opcode_SRAV(rd, rt, rs); break;
-			case 0x08: Opcode_JR(rs); break;
-			case 0x09: Opcode_JALR(rd, rs); break;
-			case 0x0c: COP_Opcode_SYSCALL(); break;
-
-				//	BREAK
-			case 0x0d:
-				console->error("Unimplemented primary opcode 0x{0:02x}, secondary opcode {1:02x}", PRIMARY_OPCODE(opcode), SECONDARY_OPCODE(opcode)); exit(1);  break;
-
-			case 0x10: Opcode_MFHI(rd); break;
-			case 0x11: Opcode_MTHI(rs); break;
-			case 0x12: Opcode_MFLO(rd); break;
-			case 0x13: Opcode_MTLO(rs); break;
-			case 0x18: Opcode_MULT(rs, rt); break;
-			case 0x19: Opcode_MULTU(rs, rt); break;
-			case 0x1a: Opcode_DIV(rs, rt); break;
-			case 0x1b: Opcode_DIVU(rs, rt); break;
-			case 0x20: Opcode_ADD(rd, rs, rt); break;
-			case 0x21: Opcode_ADDU(rs, rt, rd); break;
-			case 0x22: Opcode_SUB(rd, rs, rt); break;
-			case 0x23: Opcode_SUBU(rd, rs, rt); break;
-			case 0x24: Opcode_AND(rd, rs, rt); break;
-			case 0x25: Opcode_OR(rd, rs, rt); break;
-			case 0x26: Opcode_XOR(rd, rs, rt); break;
-			case 0x27: Opcode_NOR(rd, rs, rt); break;
-			case 0x2a: Opcode_SLT(rd, rs, rt); break;
-			case 0x2b: Opcode_SLTU(rd, rs, rt); break;
+	static constexpr OpcodeTable specialTable = makeSpecialTable();
+	static constexpr OpcodeTable cop0CommandTable = makeCOP0CommandTable();
+	static constexpr OpcodeTable cop2CommandTable = makeCOP2CommandTable();
+
+	//	COPn, indexed by rs
+	constexpr OpcodeTable makeCOPTable(const OpcodeTable& commandTable) {
+		OpcodeTable t{};
+		t[0x00] = op([](const Instruction& i) { COP_Opcode_MFC(i.rt, i.rd, (PRIMARY_OPCODE(i.opcode)) & 0b11); });
+		t[0x02] = op([](const Instruction& i) { COP_Opcode_CFC(i.rt, i.rd, (PRIMARY_OPCODE(i.opcode)) & 0b11); });
+		t[0x04] = op([](const Instruction& i) { COP_Opcode_MTC(i.rt, i.rd, (PRIMARY_OPCODE(i.opcode)) & 0b11); });
+		t[0x06] = op([](const Instruction& i) { COP_Opcode_CTC(i.rt, i.rd, (PRIMARY_OPCODE(i.opcode)) & 0b11); });
+		t[0x08] = endsBlock([](const Instruction& i) { console->info("BCn{0:s} {1:x}", (i.rt & 1) ? "T" : "F", (PRIMARY_OPCODE(i.opcode)) & 0b11); exit(1); });
+		for (u8 rs = 0x10; rs < 0x20; rs++) {
+			t[rs] = sub(commandTable, 0, 0x3f);
+		}
+		return t;
+	}
+
+	static constexpr OpcodeTable cop0Table = makeCOPTable(cop0CommandTable);
+	static constexpr OpcodeTable cop2Table = makeCOPTable(cop2CommandTable);
+
+	constexpr OpcodeTable makePrimaryTable() {
+		OpcodeTable t{};
+		t[0x00] = sub(specialTable, 0, 0x3f);
+		t[0x01] = branch([](const Instruction& i) { Opcode_BcondZ(i.rt, i.rs, i.imm16); });
+		t[0x02] = branch([](const Instruction& i) { Opcode_J(i.imm26); });
+		t[0x03] = branch([](const Instruction& i) { Opcode_JAL(i.imm26); });
+		t[0x04] = branch([](const Instruction& i) { Opcode_BEQ(i.rs, i.rt, i.imm16); });
+		t[0x05] = branch([](const Instruction& i) { Opcode_BNE(i.rs, i.rt, i.imm16); });
+		t[0x06] = branch([](const Instruction& i) { Opcode_BLEZ(i.rs, i.imm16); });
+		t[0x07] = branch([](const Instruction& i) { Opcode_BGTZ(i.rs, i.imm16); });
+		t[0x08] = op([](const Instruction& i) { Opcode_ADDI(i.rt, i.rs, i.imm16); });
+		t[0x09] = op([](const Instruction& i) { Opcode_ADDIU(i.rt, i.rs, i.imm16); });
+		t[0x0a] = op([](const Instruction& i) { Opcode_SLTI(i.rt, i.rs, i.imm16); });
+		t[0x0b] = op([](const Instruction& i) { Opcode_SLTIU(i.rt, i.rs, i.imm16); });
+		t[0x0c] = op([](const Instruction& i) { Opcode_ANDI(i.rt, i.rs, i.imm16); });
+		t[0x0d] = op([](const Instruction& i) { Opcode_ORI(i.rt, i.rs, i.imm16); });
+		t[0x0e] = op([](const Instruction& i) { Opcode_XORI(i.rt, i.rs, i.imm16); });
+		t[0x0f] = op([](const Instruction& i) { Opcode_LUI(i.rt, i.imm16); });
+		t[0x10] = sub(cop0Table, 21, 0x1f);
+		t[0x12] = sub(cop2Table, 21, 0x1f);
+		t[0x20] = op([](const Instruction& i) { Opcode_LB(i.rt, i.imm16, i.rs); }, CYCLES_LOAD);
+		t[0x21] = op([](const Instruction& i) { Opcode_LH(i.rt, i.imm16, i.rs); }, CYCLES_LOAD);
+		t[0x22] = op([](const Instruction& i) { Opcode_LWL(i.rt, i.imm16, i.rs); }, CYCLES_LOAD);
+		t[0x23] = op([](const Instruction& i) { Opcode_LW(i.rs, i.rt, i.imm16); }, CYCLES_LOAD);
+		t[0x24] = op([](const Instruction& i) { Opcode_LBU(i.rs, i.rt, i.imm16); }, CYCLES_LOAD);
+		t[0x25] = op([](const Instruction& i) { Opcode_LHU(i.rt, i.imm16, i.rs); }, CYCLES_LOAD);
+		t[0x26] = op([](const Instruction& i) { Opcode_LWR(i.rt, i.imm16, i.rs); }, CYCLES_LOAD);
+		t[0x28] = op([](const Instruction& i) { Opcode_SB(i.rt, i.imm16, i.rs); });
+		t[0x29] = op([](const Instruction& i) { Opcode_SH(i.rt, i.imm16, i.rs); });
+		t[0x2a] = op([](const Instruction& i) { Opcode_SWL(i.rt, i.imm16, i.rs); });
+		t[0x2b] = op([](const Instruction& i) { Opcode_SW(i.rs, i.rt, i.imm16); });
+		t[0x2e] = op([](const Instruction& i) { Opcode_SWR(i.rt, i.imm16, i.rs); });
+		t[0x32] = op([](const Instruction& i) { Opcode_LWC2(i.rt, i.imm16, i.rs); }, CYCLES_LOAD);
+		t[0x3a] = op([](const Instruction& i) { Opcode_SWC2(i.rt, i.imm16, i.rs); });
+		return t;
+	}
+
+	static constexpr OpcodeTable primaryTable = makePrimaryTable();
+}
+
+
+Instruction CPU::decode(word opcode) {
+
+	Instruction instr;
+	instr.opcode = opcode;
+	instr.rs = (opcode >> 21) & 0x1f;	//	base
+	instr.rt = (opcode >> 16) & 0x1f;
+	instr.rd = (opcode >> 11) & 0x1f;
+	instr.imm5 = (opcode >> 6) & 0x1f;
+	instr.imm26 = opcode & 0x3ff'ffff;
+	instr.imm16 = opcode & 0xffff;		//	offset
+
+	const OpcodeInfo* info = &primaryTable[PRIMARY_OPCODE(opcode)];
+	while (info->table) {
+		info = &info->table[(opcode >> info->shift) & info->mask];
+	}
+	instr.handler = info->handler;
+	instr.has_delay_slot = info->has_delay_slot;
+	instr.ends_block = info->ends_block;
+	instr.cycles = info->cycles;
+
+	return instr;
+}
+
+//	J / JAL at address, the region bits come from next_pc (the delay slot pc) as in Opcode_J
+word CPU::jumpTarget(word address, const Instruction& instr) {
+	return ((address + 8) & 0xf000'0000) | (instr.imm26 << 2);
+}
+
+
+/*
+	Runs the selected engine until the budget is spent (it may overshoot by one block)
+	and returns the cycles actually used. Idle loops skip ahead to the end of the budget,
+	that's when the caller syncs the hardware next.
+*/
+u32 CPU::run(u32 budget) {
+	const u64 start = CPU::cycles;
+	CPU::nextEventCycle = start + budget;
+
+	if (Lockstep::enabled) {
+		while (CPU::cycles < CPU::nextEventCycle) {
+			Lockstep::executeBlock();
+		}
+		return (u32)(CPU::cycles - start);
+	}
+
+	switch (engine) {
+		case Engine::Interpreter:
+			while (CPU::cycles < CPU::nextEventCycle) {
+				step();
+			}
+			break;
+		case Engine::CachedInterpreter:
+			while (CPU::cycles < CPU::nextEventCycle) {
+				executeBlock();
+			}
+			break;
+		case Engine::Recompiler:
+			while (CPU::cycles < CPU::nextEventCycle) {
+				Recompiler::executeBlock();
 			}
 			break;
+	}
+
+	return (u32)(CPU::cycles - start);
+}
+
+//	returns the cycles used
+u32 CPU::step() {
+
+	word opcode;
+	if (!Memory::fetchInstruction(CPU::registers.pc, opcode)) {
+		return instructionBusError();
+	}
+	BIOSCalls::enter(CPU::registers.pc);
+	if (const u32 used = HLE::call(CPU::registers.pc)) {
+		return used;
+	}
+	if (Debugger::breaking && Debugger::isBreakpoint(CPU::registers.pc)) {
+		Debugger::breakpoint(CPU::registers.pc);
+	}
+	CPU::registers.log_pc = CPU::registers.pc;
+
+	//	branch delay slot
+	CPU::registers.pc = CPU::registers.next_pc;
+	CPU::registers.next_pc += 4;
+
+	const Instruction instr = CPU::decode(opcode);
+	instr.handler(instr);
+	if (Trace::enabled) {
+		Trace::record(CPU::registers.log_pc, opcode, CPU::registers.r[instr.rt], CPU::registers.r[instr.rd]);
+	}
+	CPU::cycles += instr.cycles;
+	return instr.cycles;
+}
+
+//	returns the cycles used
+u32 CPU::executeBlock() {
+
+	word opcode;
+	if (!Memory::fetchInstruction(CPU::registers.pc, opcode)) {
+		return instructionBusError();
+	}
+	BIOSCalls::enter(CPU::registers.pc);
+	if (const u32 used = HLE::call(CPU::registers.pc)) {
+		return used;
+	}
+
+	BlockCache::Block* block = BlockCache::lookup(CPU::registers.pc);
+	if (block->breakpoint) {
+		Debugger::breakpoint(block->address);
+	}
+
+	word address = block->address;
+	u32 used = 0;
+	for (size_t i = 0; i < block->ir.size(); i++) {
+		const IR::Op& op = block->ir[i];
+
+		//	left the block (exception) or the block overwrote itself
+		if (CPU::registers.pc != address || !block->valid) {
+			break;
 		}
-		case 0x01: Opcode_BcondZ(rt, rs, imm16); break;
-		case 0x02: Opcode_J(imm26); break;
-		case 0x03: Opcode_JAL(imm26); break;
-		case 0x04: Opcode_BEQ(rs, rt, imm16); break;
-		case 0x05: Opcode_BNE(rs, rt, imm16); break;
-		case 0x06: Opcode_BLEZ(rs, imm16); break;
-		case 0x07: Opcode_BGTZ(rs, imm16); break;
-		case 0x08: Opcode_ADDI(rt, rs, imm16); break;
-		case 0x09: Opcode_ADDIU(rt, rs, imm16); break;
-		case 0x0a: Opcode_SLTI(rt, rs, imm16); break;
-		case 0x0b: Opcode_SLTIU(rt, rs, imm16); break;
-		case 0x0c: Opcode_ANDI(rt, rs, imm16); break;
-		case 0x0d: Opcode_ORI(rt, rs, imm16); break;
-		case 0x0e: Opcode_XORI(rt, rs, imm16); break;
-		case 0x0f: Opcode_LUI(rt, imm16); break;
-		case 0x20: Opcode_LB(rt, imm16, rs); break;
-		case 0x21: Opcode_LH(rt, imm16, rs); break;
-		case 0x22: Opcode_LWL(rt, imm16, rs); break;
-		case 0x23: Opcode_LW(rs, rt, imm16); break;
-		case 0x24: Opcode_LBU(rs, rt, imm16); break;
-		case 0x25: Opcode_LHU(rt, imm16, rs); break;
-		case 0x26: Opcode_LWR(rt, imm16, rs); break;
-		case 0x28: Opcode_SB(rt, imm16, rs); break;
-		case 0x29: Opcode_SH(rt, imm16, rs); break;
-		case 0x2a: Opcode_SWL(rt, imm16, rs); break;
-		case 0x2b: Opcode_SW(rs, rt, imm16); break;
-		case 0x2e: Opcode_SWR(rt, imm16, rs); break;
-		default:
-			console->error("Unimplemented opcode : {0:x}", opcode);
-			exit(1);
+
+		CPU::registers.log_pc = op.address;
+
+		//	branch delay slot, unless the instructions before this one got optimized away
+		if (op.resync) {
+			CPU::registers.pc = op.address + 4;
+			CPU::registers.next_pc = op.address + 8;
+		}
+		else {
+			CPU::registers.pc = CPU::registers.next_pc;
+			CPU::registers.next_pc += 4;
+		}
+
+		op.handler(op);
+		if (Trace::enabled) {
+			Trace::record(op.address, op.instr->opcode, CPU::registers.r[op.instr->rt], CPU::registers.r[op.instr->rd]);
+		}
+		address = op.address + 4;
+		used += op.cycles;
+
+		//	superinstruction, the next op already ran
+		if (op.fused) {
+			const IR::Op& next = block->ir[++i];
+			address = next.address + 4;
+			used += next.cycles;
 		}
 	}
+
+	CPU::cycles += used;
+	checkIdleLoop(block);
+	return used;
+}
+
+/*
+	Called after a block ran. If an idle loop candidate went around once without changing
+	any register, every further iteration would do the same until the hardware changes
+	something, so time can jump straight to the next hardware event.
+*/
+void CPU::checkIdleLoop(const BlockCache::Block* block) {
+	if (!block->idle_candidate || CPU::registers.pc != block->address || CPU::registers.next_pc != block->address + 4) {
+		idleBlock = nullptr;
+		return;
+	}
+
+	const bool unchanged = idleBlock == block &&
+		memcmp(idleSnapshot, CPU::registers.r, sizeof(CPU::registers.r)) == 0 &&
+		idleSnapshot[32] == CPU::registers.hi && idleSnapshot[33] == CPU::registers.lo;
+
+	if (unchanged) {
+		if (CPU::nextEventCycle > CPU::cycles) {
+			idleLoopStats.hits++;
+			idleLoopStats.skippedCycles += CPU::nextEventCycle - CPU::cycles;
+			CPU::cycles = CPU::nextEventCycle;
+		}
+		return;
+	}
+
+	idleBlock = block;
+	memcpy(idleSnapshot, CPU::registers.r, sizeof(CPU::registers.r));
+	idleSnapshot[32] = CPU::registers.hi;
+	idleSnapshot[33] = CPU::registers.lo;
+}
+
+void CPU::printIdleLoopStats() {
+	const double skipped = CPU::cycles ? 100.0 * idleLoopStats.skippedCycles / CPU::cycles : 0.0;
+	console->info("Idle loops: {0:d} hits, {1:d} of {2:d} cycles skipped ({3:.1f}%)", idleLoopStats.hits, idleLoopStats.skippedCycles, CPU::cycles, skipped);
 }
 
 //	Custom SpdLog Formatter to add PC etc. to CPU logs
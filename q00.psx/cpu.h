@@ -4,6 +4,10 @@
 #include "defs.h"
 #include "include/spdlog/spdlog.h"
 
+namespace BlockCache {
+	struct Block;
+}
+
 namespace R3000A {
 
 	//	Reg LUT
@@ -88,7 +92,7 @@ namespace R3000A {
 		static const u8 cause_Ovf = 0x0c;
 	};
 
-	extern COP cop[];
+	extern thread_local COP cop[];
 
 	void writeCOPReg(u8 cop_id, u8 reg_id, u32 data);
 	u32 readCOPReg(u8 cop_id, u8 reg_id);
@@ -109,10 +113,54 @@ namespace R3000A {
 		u32 lo = 0x00;
 	};
 
-	extern Registers registers;
+	extern thread_local Registers registers;
+
+	//	Pre-decoded instruction, so hot code doesn't have to be fetched and decoded over and over again
+	struct Instruction;
+	typedef void (*Handler)(const Instruction&);
+
+	struct Instruction {
+		Handler handler;
+		word opcode;
+		u8 rs;
+		u8 rt;
+		u8 rd;
+		u8 imm5;
+		u32 imm26;
+		i16 imm16;
+		bool has_delay_slot;	//	jumps and branches
+		bool ends_block;		//	exceptions, unimplemented opcodes etc.
+		u8 cycles;				//	cost in the cycle model
+	};
+
+	//	Polling loops that got fast-forwarded to the next hardware event
+	struct IdleLoopStats {
+		u64 hits = 0;
+		u64 skippedCycles = 0;
+	};
+
+	//	CPU backends, selectable with --interpreter / --cached / --recompiler
+	enum class Engine {
+		Interpreter,
+		CachedInterpreter,
+		Recompiler
+	};
+
+	extern thread_local Engine engine;
+	extern thread_local u64 cycles;				//	emulated cycles so far
+	extern thread_local u64 nextEventCycle;		//	when the hardware needs to be synced next, idle loops skip ahead to it
+	extern thread_local IdleLoopStats idleLoopStats;
 
 	void init();
-	void step();
+	u32 run(u32 budget);
+	u32 step();
+	u32 executeBlock();
+	Instruction decode(word opcode);
+	word jumpTarget(word address, const Instruction& instr);
+	void raiseException(u8 excode);
+	u32 instructionBusError();
+	void checkIdleLoop(const BlockCache::Block* block);
+	void printIdleLoopStats();
 }
 
 class CPU_PC_flag_formatter : public spdlog::custom_flag_formatter {
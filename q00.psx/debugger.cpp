@@ -0,0 +1,84 @@
+#include "debugger.h"
+#include "cpu.h"
+#include "mmu.h"
+#include "blockcache.h"
+#include <algorithm>
+#define CPU R3000A
+
+static auto console = spdlog::stdout_color_mt("Debugger");
+
+namespace Debugger {
+	std::vector<Watchpoint> watchpoints;
+	std::vector<word> breakpoints;
+	bool watching = false;
+	bool breaking = false;
+	u64 watchedPages[BITMAP_WORDS(DEBUGGER_PAGE_COUNT)] = { 0 };
+
+	//	the mirrors of RAM are the same memory
+	static word fold(word address) {
+		address = MASKED_ADDRESS(address);
+		return address < RAM_MIRRORS_END ? address & (RAM_SIZE - 1) : address;
+	}
+}
+
+//	pages already mapped (and code already built) on this thread lose their fast paths right away
+void Debugger::watch(word address, word size, u8 access) {
+	const word start = fold(address);
+	size = std::max<word>(size, 1);
+	if (start < SCRATCHPAD_START + MEMORY_PAGE_SIZE && start + size > SCRATCHPAD_START) {
+		console->error("The scratchpad can't be watched ({0:08x})", address);
+		exit(1);
+	}
+	watchpoints.push_back({ start, start + size, access });
+	watching = true;
+
+	for (u32 page = start >> MEMORY_PAGE_SHIFT; page <= (start + size - 1) >> MEMORY_PAGE_SHIFT; page++) {
+		BITMAP_SET(watchedPages, page);
+		if (Memory::readPages) {
+			Memory::watchPage(page);
+		}
+	}
+	if (Memory::readPages) {
+		BlockCache::flush();
+	}
+	console->info("Watching {0:s} of {1:x} bytes at {2:08x}", access == (Read | Write) ? "reads / writes" : (access & Read) ? "reads" : "writes", size, start);
+}
+
+//	blocks are split at breakpoints when they get built, the ones already there are thrown away
+void Debugger::addBreakpoint(word address) {
+	breakpoints.push_back(MASKED_ADDRESS(address));
+	breaking = true;
+	if (Memory::readPages) {
+		BlockCache::flush();
+	}
+	console->info("Breakpoint at {0:08x}", address);
+}
+
+bool Debugger::isBreakpoint(word address) {
+	return std::find(breakpoints.begin(), breakpoints.end(), MASKED_ADDRESS(address)) != breakpoints.end();
+}
+
+void Debugger::read(word address, u32 size, u32 value) {
+	const word start = fold(address);
+	for (const Watchpoint& watchpoint : watchpoints) {
+		if ((watchpoint.access & Read) && start < watchpoint.end && start + size > watchpoint.start) {
+			console->info("{0:08x}: read {1:d} bytes at {2:08x}: {3:x}", CPU::registers.log_pc, size, address, value);
+			return;
+		}
+	}
+}
+
+void Debugger::write(word address, u32 size, u32 value, u32 previous) {
+	const word start = fold(address);
+	for (const Watchpoint& watchpoint : watchpoints) {
+		if ((watchpoint.access & Write) && start < watchpoint.end && start + size > watchpoint.start) {
+			console->info("{0:08x}: wrote {1:d} bytes at {2:08x}: {3:x} (was {4:x})", CPU::registers.log_pc, size, address, value, previous);
+			return;
+		}
+	}
+}
+
+void Debugger::breakpoint(word address) {
+	console->info("Breakpoint {0:08x}: ra {1:08x} sp {2:08x} a0 {3:08x} a1 {4:08x} a2 {5:08x} a3 {6:08x} v0 {7:08x}", address,
+		CPU::registers.r[31], CPU::registers.r[29], CPU::registers.r[4], CPU::registers.r[5], CPU::registers.r[6], CPU::registers.r[7], CPU::registers.r[2]);
+}
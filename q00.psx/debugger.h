@@ -0,0 +1,54 @@
+#pragma once
+#ifndef DEBUGGER_GUARD
+#define DEBUGGER_GUARD
+#include "defs.h"
+#include <vector>
+#define DEBUGGER_PAGE_COUNT (0x2000'0000 >> 12)		//	4 KiB pages of the masked address space, RAM mirrors fold onto RAM (BLOCK_CACHE_PAGE)
+
+/*
+	Watchpoints and execution breakpoints, set with --watch / --watch-read / --break.
+	A page with a watchpoint on it is left out of the page tables (and the fastmem window),
+	so only accesses to it take fetchSlow / storeSlow, which check the exact ranges and log
+	the hits. The block IR doesn't turn accesses to watched pages into direct RAM accesses.
+	A breakpoint always starts a block of its own and is checked where the block is looked
+	up, blocks with one are never linked to. Only the interpreter checks every instruction
+	(and sees breakpoints in delay slots).
+	CPU loads / stores only, DMA and HLE don't hit watchpoints. The scratchpad has no page
+	table entry, so it can't be watched. Under --lockstep every hit is seen twice.
+	Nothing of this costs anything while no watchpoint / breakpoint is set. It's process-wide
+	and can't be used with --batch.
+*/
+namespace Debugger {
+
+	enum Access : u8 {
+		Read = 1,
+		Write = 2
+	};
+
+	struct Watchpoint {
+		word start;		//	masked, RAM mirrors folded onto RAM
+		word end;		//	exclusive
+		u8 access;
+	};
+
+	extern std::vector<Watchpoint> watchpoints;
+	extern std::vector<word> breakpoints;		//	masked
+	extern bool watching;		//	any watchpoint set (cleared while fetchSlow reads a watched page)
+	extern bool breaking;		//	any breakpoint set
+	extern u64 watchedPages[BITMAP_WORDS(DEBUGGER_PAGE_COUNT)];
+
+	void watch(word address, word size, u8 access);
+	void addBreakpoint(word address);
+	bool isBreakpoint(word address);
+
+	//	called by the slow paths for accesses to watched pages / block entry
+	void read(word address, u32 size, u32 value);
+	void write(word address, u32 size, u32 value, u32 previous);
+	void breakpoint(word address);
+
+	inline bool isWatchedPage(u32 page) {
+		return BITMAP_TEST(watchedPages, page);
+	}
+}
+
+#endif
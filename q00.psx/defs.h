@@ -19,5 +19,10 @@ typedef u8 byte;
 #define SIGN_EXT32(a) ((int32_t)(int16_t)a)
 #define SIGN_EXT64(a) ((int64_t)(int32_t)a)
 
+#define BITMAP_WORDS(bits) (((bits) + 63) / 64)
+#define BITMAP_TEST(map, i) (((map)[(i) >> 6] >> ((i) & 63)) & 1)
+#define BITMAP_SET(map, i) ((map)[(i) >> 6] |= (u64)1 << ((i) & 63))
+#define BITMAP_CLEAR(map, i) ((map)[(i) >> 6] &= ~((u64)1 << ((i) & 63)))
+
 #define SIGN_EXT_BYTE_TO_WORD(a) SIGN_EXT8_TO_32(a)
 #define SIGN_EXT_HWORD_TO_WORD(a) SIGN_EXT16_TO_32(a)
\ No newline at end of file
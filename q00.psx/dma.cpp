@@ -1,15 +1,18 @@
 #include "dma.h"
 #include "mmu.h"
+#include "io.h"
+#include <algorithm>
+#define DMA_CHANNEL(address) ((address - 0x1f80'1080) >> 4)
 
 namespace DMA {
 
 	std::shared_ptr<spdlog::logger> console = spdlog::stdout_color_mt("DMA");
 
-	u32 dma2_target_words = 0;	//	approx value of clk cycles necessary for the inited dma
-	u32 dma2_clk_count = 0;
+	thread_local u32 dma2_target_words = 0;	//	approx value of clk cycles necessary for the inited dma
+	thread_local u32 dma2_clk_count = 0;
 
-	u32 dma6_target_clks = 0;	//	approx value of clk cycles necessary for the inited dma
-	u32 dma6_word_count = 0;
+	thread_local u32 dma6_target_clks = 0;	//	approx value of clk cycles necessary for the inited dma
+	thread_local u32 dma6_word_count = 0;
 
 	union DMA_Control_Register {
 		struct {
@@ -30,7 +33,8 @@ namespace DMA {
 			u32 : 4;
 		};
 		u32 raw = 0x0765'4321;
-	} dma_control_register;
+	};
+	thread_local DMA_Control_Register dma_control_register;
 	static_assert(sizeof(DMA_Control_Register) == sizeof(u32), "Union not at the expected size!");
 
 	union DMA_Interrupt_Register {
@@ -55,7 +59,8 @@ namespace DMA {
 			u32 irq_signal : 1;
 		};
 		u32 raw;
-	} dma_interrupt_register;
+	};
+	thread_local DMA_Interrupt_Register dma_interrupt_register;
 	static_assert(sizeof(DMA_Interrupt_Register) == sizeof(u32), "Union not at the expected size!");
 
 	union DMA_Block_Control {
@@ -103,9 +108,9 @@ namespace DMA {
 	};
 	static_assert(sizeof(DMA_Channel_Control) == sizeof(u32), "Union not at the expected size!");
 
-	u32 dma_base_address[7];
-	DMA_Block_Control dma_block_control[7];
-	DMA_Channel_Control dma_channel_control[7];
+	thread_local u32 dma_base_address[7];
+	thread_local DMA_Block_Control dma_block_control[7];
+	thread_local DMA_Channel_Control dma_channel_control[7];
 	
 	void DMA::writeDMABaseAddress(u32 data, u8 channel) {
 		dma_base_address[channel] = data;
@@ -193,6 +198,62 @@ namespace DMA {
 		//console->info("Reading DMA (channel {0:x}) channel control", channel);
 		return dma_channel_control[channel].raw;
 	}
+
+	void DMA::mapIO() {
+		//	everything in the DMA range that isn't one of its registers
+		IO::mapReadRange(0x1f80'1080, 0x1f80'1100, [](word address) -> u32 {
+			console->error("Invalid DMA read at {0:x}", address);
+			exit(1);
+		});
+		IO::mapWriteRange(0x1f80'1080, 0x1f80'1100, [](word address, u32) {
+			console->error("Invalid DMA write at {0:x}", address);
+			exit(1);
+		});
+
+		//	base address, block control and channel control of channel N
+		for (u8 channel = 0; channel < 7; channel++) {
+			const word base = 0x1f80'1080 + 0x10 * channel;
+			IO::mapRead(base, [](word address) -> u32 {
+				return readDMABaseAddress(DMA_CHANNEL(address));
+			});
+			IO::mapRead(base + 4, [](word address) -> u32 {
+				console->error("Reading DMA (channel {0:x}) block control [${1:08x}]", DMA_CHANNEL(address), address);
+				exit(1);
+			});
+			IO::mapRead(base + 8, [](word address) -> u32 {
+				return readDMAChannelControl(DMA_CHANNEL(address));
+			});
+			IO::mapWrite(base, [](word address, u32 data) {
+				writeDMABaseAddress(data & 0xff'ffff, DMA_CHANNEL(address));
+			});
+			IO::mapWrite(base + 4, [](word address, u32 data) {
+				writeDMABlockControl(data, DMA_CHANNEL(address));
+			});
+			IO::mapWrite(base + 8, [](word address, u32 data) {
+				writeDMAChannelControl(data, DMA_CHANNEL(address));
+			});
+		}
+
+		IO::mapRead(0x1f80'10f0, [](word) -> u32 { return readDMAControlRegister(); });
+		IO::mapRead(0x1f80'10f4, [](word) -> u32 { return readDMAInterruptRegister(); });
+		IO::mapWrite(0x1f80'10f0, [](word, u32 data) { writeDMAControlRegister(data); });
+		IO::mapWrite(0x1f80'10f4, [](word, u32 data) { writeDMAInterruptRegister(data); });
+	}
+
+	//	count words from RAM to GP0, starting at address and going down instead of up if backward
+	void sendToGPU(word address, u32 count, bool backward) {
+		word buffer[0x100];
+		address &= ~3;
+		while (count > 0) {
+			const u32 chunk = std::min<u32>(count, 0x100);
+			Memory::readBlock(backward ? address - (chunk - 1) * 4 : address, buffer, chunk * 4);
+			for (u32 i = 0; i < chunk; i++) {
+				GPU::sendCommandGP0(buffer[backward ? chunk - 1 - i : i]);
+			}
+			address = backward ? address - chunk * 4 : address + chunk * 4;
+			count -= chunk;
+		}
+	}
 }
 
 
@@ -208,17 +269,8 @@ void DMA::tick() {
 			word val = Memory::readFromMemory<word>(dma_base_address[2]);
 			u8 wordCount = val >> 24;
 			const bool forward = dma_channel_control[2].flags.memory_address_step == MEMORY_ADDRESS_STEP::backward_minus_4;
-			for (int i = 1; i <= wordCount; i++) {
-				word command = 0;
-				if (forward) {
-					command = Memory::readFromMemory<word>(dma_base_address[2] - i * 0x4);
-				}
-				else {
-					command = Memory::readFromMemory<word>(dma_base_address[2] + i * 0x4);
-				}
-				console->info("DMA2 - Sending GP0 command {0:x}", command);
-				GPU::sendCommandGP0(command);
-			}
+			console->info("DMA2 - Sending {0:d} GP0 words", wordCount);
+			sendToGPU(forward ? dma_base_address[2] - 0x4 : dma_base_address[2] + 0x4, wordCount, forward);
 			dma_base_address[2] = val & 0xff'ffff;
 			
 			//	end marker
@@ -253,17 +305,7 @@ void DMA::tick() {
 			else if (dma_channel_control[2].flags.transfer_direction == TRANSFER_DIRECTION::from_main_ram) {
 				const bool forward = dma_channel_control[2].flags.memory_address_step == MEMORY_ADDRESS_STEP::backward_minus_4;
 				word wordCount = dma_block_control[2].syncmode_1.blocksize * dma_block_control[2].syncmode_1.amount_of_blocks;
-				for (int i = 0; i < wordCount; i++) {
-					word command = 0;
-					if (forward) {
-						command = Memory::readFromMemory<word>(dma_base_address[2] - i * 4);
-					}
-					else {
-						command = Memory::readFromMemory<word>(dma_base_address[2] + i * 4);
-					}
-					//console->info("DMA2 - Syncmode 1 - Sending command to GPU {0:x}", command);
-					GPU::sendCommandGP0(command);
-				}
+				sendToGPU(dma_base_address[2], wordCount, forward);
 				dma_channel_control[2].flags.start_busy = START_BUSY::stopped_completed;
 				console->info("Completed DMA2 Syncmode 1");
 			}
@@ -20,6 +20,7 @@ namespace DMA {
 	u32 readDMABaseAddress(u8 channel);
 	u32 readDMAChannelControl(u8 channel);
 
+	void mapIO();
 	void tick();
 }
 
@@ -0,0 +1,60 @@
+#include "emulator.h"
+#include "mmu.h"
+#include "gpu.h"
+#include "spu.h"
+#include "dma.h"
+#include "gte.h"
+#include "blockcache.h"
+#include "recompiler.h"
+#include "fileimport.h"
+#include "include/spdlog/spdlog.h"
+#include "include/spdlog/sinks/stdout_color_sinks.h"
+
+static auto console = spdlog::stdout_color_mt("Emulator");
+
+void Emulator::start() {
+	thread = std::thread(&Emulator::run, this);
+}
+
+void Emulator::join() {
+	if (thread.joinable()) {
+		thread.join();
+	}
+}
+
+void Emulator::run() {
+	Memory::ttyOutput = &tty;
+	R3000A::engine = engine;
+	R3000A::init();
+	GTE::init();
+	Memory::init();
+	BlockCache::init();
+	GPU::init();
+	SPU::init();
+	if (!bios.empty()) {
+		FileImport::loadBIOS(bios.c_str());
+	}
+	if (R3000A::engine == R3000A::Engine::Recompiler && !Recompiler::init()) {
+		console->warn("Recompiler not available, falling back to the cached interpreter");
+		R3000A::engine = R3000A::Engine::CachedInterpreter;
+	}
+	if (!exe.empty()) {
+		FileImport::loadEXE(exe.c_str());
+	}
+
+	while (R3000A::cycles < cycles) {
+		R3000A::run(DEVICE_SYNC_CYCLES);
+		DMA::tick();
+	}
+
+	if (finished) {
+		finished();
+	}
+
+	Recompiler::shutdown();
+	BlockCache::shutdown();
+	SPU::shutdown();
+	GPU::shutdown();
+	Memory::shutdown();
+	Memory::ttyOutput = nullptr;
+}
@@ -0,0 +1,34 @@
+#pragma once
+#ifndef EMULATOR_GUARD
+#define EMULATOR_GUARD
+#include "defs.h"
+#include "cpu.h"
+#include <functional>
+#include <string>
+#include <thread>
+#define DEVICE_SYNC_CYCLES 256		//	the CPU runs this long between hardware syncs
+
+/*
+	One headless console (no window, no UI).
+	The machine state of every component (CPU, memory, GPU, DMA, SPU, the block cache, ..) is
+	thread_local, so an instance owns a thread and does all of its work on it: init, loading,
+	running and reading out the results in finished. Any number of them can run side by side
+	in one process, they only share read-only data like the BIOS image.
+	--hle / --lockstep / --no-ir-opt are process-wide settings, --trace / --watch / --break need
+	a single instance.
+*/
+struct Emulator {
+	std::string bios;				//	optional
+	std::string exe;				//	optional, loaded after the BIOS
+	R3000A::Engine engine = R3000A::Engine::CachedInterpreter;
+	u64 cycles = 0;					//	how long to run
+	std::function<void()> finished;	//	called on the instance's thread before it's torn down
+	std::string tty;				//	what the program printed (putchar)
+	std::thread thread;
+
+	void start();
+	void join();
+	void run();						//	on the calling thread
+};
+
+#endif
@@ -6,6 +6,15 @@
 #include <iostream>
 #include <fstream>
 #include <algorithm>
+#include <map>
+#include <mutex>
+#include <vector>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 #include "include/spdlog/spdlog.h"
 #include "include/spdlog/sinks/stdout_color_sinks.h"
 using namespace std;
@@ -16,8 +25,26 @@ using namespace R3000A;
 
 static auto console = spdlog::stdout_color_mt("FileImport");
 
+/*
+	BIOS images by filename, loaded once per process and shared by every emulator instance.
+	A full size image is the read-only mapping of the file itself (the BIOS pages read straight
+	from it, no copy), shorter ones are padded with zeroes. They're never unloaded.
+*/
+struct BIOSImage {
+	FileImport::PSX_FILE file;
+	std::vector<u8> padded;
+	const u8* data;
+	u32 crc;
+};
+static std::mutex biosMutex;
+static std::map<std::string, BIOSImage> biosImages;
+
 void FileImport::loadEXE(const char filename[]) {
 	PSX_FILE file = FileImport::loadFile(filename);
+	if (file.size < FILE_DATA_START) {
+		console->error("{0:s} is not a PSX EXE", filename);
+		exit(1);
+	}
 
 	word initialPC = Utils::readWord(file.ptr, 0x10);
 	word initialGP = Utils::readWord(file.ptr, 0x14);
@@ -42,25 +69,47 @@ void FileImport::loadEXE(const char filename[]) {
 	R3000A::registers.r[registers.gp] = initialGP;
 	R3000A::registers.r[registers.sp] = initialSPBase + initialSPOffs;
 
-	Memory::loadToRAM(ramStart, file.ptr, FILE_DATA_START, fileSize);
+	Memory::loadToRAM(ramStart, file.ptr, FILE_DATA_START, std::min<word>(fileSize, file.size - FILE_DATA_START));
+	unloadFile(file);
 }
 
 void FileImport::loadBIOS(const char filename[]) {
-	PSX_FILE file = FileImport::loadFile(filename);
+	std::unique_lock<std::mutex> lock(biosMutex);
+	auto it = biosImages.find(filename);
+	if (it == biosImages.end()) {
+		BIOSImage image;
+		image.file = FileImport::loadFile(filename);
+		image.crc = Utils::crc32(image.file.ptr, image.file.size);
+		if (image.file.size >= BIOS_SIZE) {
+			image.data = image.file.ptr;
+		}
+		else {
+			image.padded.resize(BIOS_SIZE, 0);
+			if (image.file.size > 0) {
+				memcpy(image.padded.data(), image.file.ptr, image.file.size);
+			}
+			unloadFile(image.file);
+			image.data = image.padded.data();
+		}
+		it = biosImages.emplace(filename, std::move(image)).first;
+	}
+	lock.unlock();
+	const u8* image = it->second.data;
 
-	word kernelBCDdate = Utils::readWord(file.ptr, 0x100);
-	word consoleType = Utils::readWord(file.ptr, 0x104);
+	word kernelBCDdate = Utils::readWord(image, 0x100);
+	word consoleType = Utils::readWord(image, 0x104);
 	std::string versionString = "";
 	word verPos = 0x108;
-	while (verPos < 0x150) {
-		versionString += Utils::readChar(file.ptr, verPos++);
+	while (verPos < 0x150 && Utils::readChar(image, verPos)) {
+		versionString += Utils::readChar(image, verPos++);
 	}
 
 	console->info("Kernel BCD Date: {0:x}", kernelBCDdate);
 	console->info("Console type: {0:x}", consoleType);
 	console->info("Version: {0:s}", versionString);
+	console->info("CRC32: {0:08x}", it->second.crc);
 
-	Memory::loadBIOS(file.ptr, file.size);
+	Memory::loadBIOS(image);
 
 	R3000A::registers.pc = 0xbfc0'0000;
 	R3000A::registers.next_pc = 0xbfc0'0004;
@@ -78,26 +127,54 @@ void FileImport::saveFile(const char filename[], u8* data, u32 dataSize) {
 	fout.close();
 }
 
+//	mapped read-only on Linux (the page cache is shared, nothing gets copied), read into the heap elsewhere
 FileImport::PSX_FILE FileImport::loadFile(const char filename[]) {
-	streampos size;
-	u8* fileInMemory = new u8;
+	FileImport::PSX_FILE res = { nullptr, 0, false };
+
+#ifdef __linux__
+	const int fd = open(filename, O_RDONLY | O_CLOEXEC);
+	if (fd >= 0) {
+		struct stat info;
+		if (fstat(fd, &info) == 0 && info.st_size > 0) {
+			void* mapping = mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+			if (mapping != MAP_FAILED) {
+				res = { (const u8*)mapping, (int)info.st_size, true };
+			}
+		}
+		close(fd);
+		if (res.mapped) {
+			console->info("Successfully mapped file {0:s}", filename);
+			return res;
+		}
+	}
+#endif
 
 	ifstream file(filename, ios::in | ios::binary | ios::ate);
 	if (file.is_open()) {
-		size = file.tellg();
-		fileInMemory = new u8[size];
+		const streampos size = file.tellg();
+		u8* fileInMemory = new u8[size];
 		file.seekg(0, ios::beg);
 		file.read((char *)fileInMemory, size);
 		file.close();
+		res = { fileInMemory, (int)size, false };
 		console->info("Successfully loaded file {0:s}", filename);
 	}
 	else {
 		console->critical("Error while loading file {0:s}", filename);
 	}
 
-	FileImport::PSX_FILE res;
-	res.size = size;
-	res.ptr = fileInMemory;
-
 	return res;
+}
+
+void FileImport::unloadFile(PSX_FILE& file) {
+#ifdef __linux__
+	if (file.mapped) {
+		munmap((void*)file.ptr, file.size);
+	}
+	else
+#endif
+	{
+		delete[] file.ptr;
+	}
+	file = { nullptr, 0, false };
 }
\ No newline at end of file
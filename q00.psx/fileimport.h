@@ -6,13 +6,15 @@
 namespace FileImport {
 
 	typedef struct {
-		byte* ptr;
+		const byte* ptr;
 		int size;
+		bool mapped;		//	ptr is a read-only mapping of the file, otherwise a copy on the heap
 	} PSX_FILE;
 
 	void loadEXE(const char[]);
 	void loadBIOS(const char[]);
-	PSX_FILE loadFile(const char[]);
+	PSX_FILE loadFile(const char[]);		//	size 0 if it can't be read
+	void unloadFile(PSX_FILE& file);
 	void saveFile(const char filename[], u8* data, u32 dataSize);
 }
 
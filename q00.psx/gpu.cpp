@@ -1,4 +1,5 @@
 #include "gpu.h"
+#include "io.h"
 #include "include/spdlog/spdlog.h"
 #include "include/spdlog/sinks/stdout_color_sinks.h"
 #include <SDL.h>
@@ -19,10 +20,10 @@ namespace GPU {
 		GPU_A0_PENDING,
 		GPU_C0_PENDING
 	};
-	GPU_STATE pending_gpu_state = GPU_STATE::IDLE;
+	thread_local GPU_STATE pending_gpu_state = GPU_STATE::IDLE;
 
 	//	pending command var
-	u32 a0_startx, a0_starty, a0_posx, a0_posy, a0_endx, a0_endy;
+	thread_local u32 a0_startx, a0_starty, a0_posx, a0_posy, a0_endx, a0_endy;
 
 	enum class SEMI_TRANSPARENCY : u32 { back_half_plus_front_half = 0, back_plus_front = 1, back_minus_front = 2, back_plus_front_quarter = 3 };
 	enum class TEXTURE_PAGE_COLORS : u32 { col_4b = 0, col_8b = 1, col_15b = 2, reserved = 3 };
@@ -81,14 +82,15 @@ namespace GPU {
 			u32 get() {
 				return raw | 0x1c00'0000;	//	to always enable "ready to.." fields
 			}
-	} gpustat;
+	};
+	thread_local GPUSTAT gpustat;
 
-	std::deque<u32> fifoBuffer;
-	u16* vram;
+	thread_local std::deque<u32> fifoBuffer;
+	thread_local u16* vram = nullptr;
 
 	//	copy rectangle (vram to cpu)
 	namespace copy_rectangle_vram_to_cpu {
-		u16 startx, starty, posx, posy, endx, endy;
+		thread_local u16 startx, starty, posx, posy, endx, endy;
 
 		u32 read() {
 			u32 pos = VRAM_ROW_LENGTH * posy + posx;
@@ -111,7 +113,6 @@ namespace GPU {
 	}
 
 	//	SDL
-	void setupSDL();
 	SDL_Window* win = NULL;
 	SDL_Renderer* renderer = NULL;
 	SDL_Texture* img = NULL;
@@ -140,9 +141,19 @@ void GPU::init() {
 
 	//	vram array on the heap (1MB VRAM)
 	vram = new u16[0x100'000] { 0x0 };
+}
+
+void GPU::mapIO() {
+	IO::mapRead(0x1f80'1810, [](word) -> u32 { return readGPUREAD(); });
+	IO::mapRead(0x1f80'1814, [](word) -> u32 { return readGPUSTAT(); });
+	IO::mapWrite(0x1f80'1810, [](word, u32 data) { sendCommandGP0(data); });
+	IO::mapWrite(0x1f80'1814, [](word, u32 data) { sendCommandGP1(data); });
+}
 
-	//	init SDL window
-	GPU::setupSDL();
+void GPU::shutdown() {
+	delete[] vram;
+	vram = nullptr;
+	fifoBuffer.clear();
 }
 
 void GPU::setupSDL() {
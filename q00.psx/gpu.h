@@ -33,6 +33,9 @@ namespace GPU {
 	};
 
 	void init();
+	void mapIO();
+	void setupSDL();		//	window for draw(), headless instances skip it
+	void shutdown();
 
 	void sendCommandGP0(word cmd);
 	void sendCommandGP1(word cmd);
@@ -0,0 +1,795 @@
+#include "gte.h"
+#include <algorithm>
+#include <string.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__)
+#include <emmintrin.h>
+#define GTE_SSE2 true
+#endif
+
+static auto console = spdlog::stdout_color_mt("GTE");
+
+//	command fields
+#define GTE_SF(c) (((c >> 19) & 1) * 12)
+#define GTE_LM(c) ((c >> 10) & 1)
+#define GTE_MX(c) ((c >> 17) & 3)
+#define GTE_V(c) ((c >> 15) & 3)
+#define GTE_CV(c) ((c >> 13) & 3)
+
+//	FLAG bits
+#define FLAG_MAC_POSITIVE(i) (1 << (31 - i))	//	MAC1..3 larger than 43 bits
+#define FLAG_MAC_NEGATIVE(i) (1 << (28 - i))
+#define FLAG_IR(i) (1 << (25 - i))				//	IR1..3 saturated
+#define FLAG_COLOR(i) (1 << (22 - i))			//	color FIFO R / G / B saturated
+#define FLAG_SZ3_OTZ (1 << 18)
+#define FLAG_DIVIDE (1 << 17)
+#define FLAG_MAC0_POSITIVE (1 << 16)
+#define FLAG_MAC0_NEGATIVE (1 << 15)
+#define FLAG_SX2 (1 << 14)
+#define FLAG_SY2 (1 << 13)
+#define FLAG_IR0 (1 << 12)
+#define FLAG_ERROR_MASK 0x7f87'e000			//	bits 30..23 and 18..13 are ORed into bit 31
+
+namespace GTE {
+
+	//	registers are kept the way they read back (16 bit ones already sign / zero extended)
+	thread_local u32 data[32];
+	thread_local u32 control[32];
+	thread_local u32 flag;
+
+	enum DataRegister {
+		VXY0 = 0, VZ0 = 1, RGBC = 6, OTZ = 7, IR0 = 8, SXY0 = 12, SXYP = 15, SZ0 = 16,
+		RGB0 = 20, RES1 = 23, MAC0 = 24, IRGB = 28, ORGB = 29, LZCS = 30, LZCR = 31
+	};
+	enum ControlRegister {
+		RT = 0, TR = 5, LLM = 8, BK = 13, LCM = 16, FC = 21, OFX = 24, OFY = 25, H = 26, DQA = 27, DQB = 28, ZSF3 = 29, ZSF4 = 30, FLAG = 31
+	};
+
+	typedef i16 Matrix[9];
+	typedef i16 Vector[3];
+
+	//	reciprocal table for the UNR division
+	struct UNRTable {
+		u8 values[0x101];
+		constexpr UNRTable() : values() {
+			for (int i = 0; i < 0x101; i++) {
+				values[i] = (u8)std::max(0, (0x40000 / (i + 0x100) + 1) / 2 - 0x101);
+			}
+		}
+	};
+	static constexpr UNRTable unrTable;
+
+	inline i16 lo(u32 v) { return (i16)(v & 0xffff); }
+	inline i16 hi(u32 v) { return (i16)(v >> 16); }
+
+	void getMatrix(u8 base, Matrix m);
+	void getVector(u8 index, Vector v);
+	void multiply(const Matrix m, const Vector* v, int count, i32* products);
+
+	i64 checkMAC(u8 index, i64 value);
+	void checkMAC0(i64 value);
+	void setMAC(u8 index, i64 value, u8 shift);
+	void setIR(u8 index, i32 value, bool lm);
+	void setMACAndIR(u8 index, i64 value, u8 shift, bool lm);
+	void pushSZ(i32 value);
+	void pushSXY(i32 x, i32 y);
+	void pushColor();
+	u32 divide(u16 h, u16 sz3);
+
+	void transform(const i32* products, const i32 t[3], u8 shift, bool lm);
+	void transformBuggy(const Matrix m, const i32 t[3], const Vector v, u8 shift, bool lm);
+	void perspective(const i32* products, u8 shift, bool lm, bool last);
+	void lightColor(u8 shift, bool lm);
+	void interpolateColor(i64 mac1, i64 mac2, i64 mac3, u8 shift, bool lm);
+	void normalColor(const i32* products, u8 shift, bool lm, u8 mode);
+	void normalColorTriple(word c, u8 mode);
+
+	void RTPS(word c); void RTPT(word c); void NCLIP(word c); void OP(word c); void DPCS(word c); void DPCT(word c);
+	void INTPL(word c); void MVMVA(word c); void NCDS(word c); void NCDT(word c); void CDP(word c); void NCCS(word c);
+	void NCCT(word c); void CC(word c); void NCS(word c); void NCT(word c); void SQR(word c); void DCPL(word c);
+	void AVSZ3(word c); void AVSZ4(word c); void GPF(word c); void GPL(word c);
+}
+
+void GTE::init() {
+	memset(data, 0, sizeof(data));
+	memset(control, 0, sizeof(control));
+	flag = 0;
+	writeData(LZCS, 0);
+	console->info("GTE init");
+}
+
+GTE::State GTE::saveState() {
+	State state;
+	memcpy(state.data, data, sizeof(data));
+	memcpy(state.control, control, sizeof(control));
+	state.flag = flag;
+	return state;
+}
+
+void GTE::loadState(const State& state) {
+	memcpy(data, state.data, sizeof(data));
+	memcpy(control, state.control, sizeof(control));
+	flag = state.flag;
+}
+
+
+//	Registers
+
+u32 GTE::readData(u8 reg) {
+	switch (reg) {
+		//	SXYP mirrors SXY2
+		case SXYP:
+			return data[SXY0 + 2];
+
+		//	IRGB and ORGB both read the IR1..3 converted to 5:5:5
+		case IRGB:
+		case ORGB: {
+			auto saturate = [](i16 v) -> u32 { return (v < 0) ? 0 : (v > 0xf80) ? 0x1f : (v >> 7); };
+			return saturate(lo(data[IR0 + 1])) | (saturate(lo(data[IR0 + 2])) << 5) | (saturate(lo(data[IR0 + 3])) << 10);
+		}
+
+		default:
+			return data[reg];
+	}
+}
+
+void GTE::writeData(u8 reg, u32 value) {
+	switch (reg) {
+		//	16 bit signed
+		case VZ0:
+		case VZ0 + 2:
+		case VZ0 + 4:
+		case IR0:
+		case IR0 + 1:
+		case IR0 + 2:
+		case IR0 + 3:
+			data[reg] = (u32)(i32)lo(value);
+			break;
+
+		//	16 bit unsigned
+		case OTZ:
+		case SZ0:
+		case SZ0 + 1:
+		case SZ0 + 2:
+		case SZ0 + 3:
+			data[reg] = value & 0xffff;
+			break;
+
+		//	writing SXYP moves the screen XY FIFO
+		case SXYP:
+			data[SXY0] = data[SXY0 + 1];
+			data[SXY0 + 1] = data[SXY0 + 2];
+			data[SXY0 + 2] = value;
+			break;
+
+		//	5:5:5 color to IR1..3
+		case IRGB:
+			data[IR0 + 1] = (value & 0x1f) << 7;
+			data[IR0 + 2] = ((value >> 5) & 0x1f) << 7;
+			data[IR0 + 3] = ((value >> 10) & 0x1f) << 7;
+			break;
+
+		//	read only
+		case ORGB:
+		case LZCR:
+			break;
+
+		//	LZCR counts the leading bits that equal the sign bit
+		case LZCS: {
+			data[LZCS] = value;
+			u32 bits = (value & 0x8000'0000) ? ~value : value;
+			u32 count = 0;
+			while (count < 32 && !(bits & (0x8000'0000 >> count))) {
+				count++;
+			}
+			data[LZCR] = count;
+			break;
+		}
+
+		default:
+			data[reg] = value;
+			break;
+	}
+}
+
+u32 GTE::readControl(u8 reg) {
+	if (reg == FLAG) {
+		return flag;
+	}
+	return control[reg];
+}
+
+void GTE::writeControl(u8 reg, u32 value) {
+	switch (reg) {
+		//	16 bit signed (H is unsigned, but reads back sign extended as well)
+		case RT + 4:
+		case LLM + 4:
+		case LCM + 4:
+		case H:
+		case DQA:
+		case ZSF3:
+		case ZSF4:
+			control[reg] = (u32)(i32)lo(value);
+			break;
+
+		case FLAG:
+			flag = value & 0x7fff'f000;
+			if (flag & FLAG_ERROR_MASK) {
+				flag |= 0x8000'0000;
+			}
+			break;
+
+		default:
+			control[reg] = value;
+			break;
+	}
+}
+
+//	3x3 matrix out of 5 control registers (RT, LLM, LCM)
+void GTE::getMatrix(u8 base, Matrix m) {
+	for (int i = 0; i < 9; i++) {
+		m[i] = (i & 1) ? hi(control[base + i / 2]) : lo(control[base + i / 2]);
+	}
+}
+
+//	V0..V2, or IR1..3 for index 3
+void GTE::getVector(u8 index, Vector v) {
+	if (index == 3) {
+		v[0] = lo(data[IR0 + 1]);
+		v[1] = lo(data[IR0 + 2]);
+		v[2] = lo(data[IR0 + 3]);
+	}
+	else {
+		v[0] = lo(data[VXY0 + index * 2]);
+		v[1] = hi(data[VXY0 + index * 2]);
+		v[2] = lo(data[VZ0 + index * 2]);
+	}
+}
+
+
+/*
+	Matrix * vector products for up to three vectors in one SIMD pass:
+	products[n * 9 + row * 3 + col] = m[row][col] * v[n][col]
+	The sums are not done here, the flags need the overflow check after every single addition.
+*/
+void GTE::multiply(const Matrix m, const Vector* v, int count, i32* products) {
+	alignas(32) i16 a[32] = { 0 };
+	alignas(32) i16 b[32] = { 0 };
+	const int lanes = count * 9;
+	for (int n = 0; n < count; n++) {
+		for (int i = 0; i < 9; i++) {
+			a[n * 9 + i] = m[i];
+			b[n * 9 + i] = v[n][i % 3];
+		}
+	}
+
+#if defined(__AVX2__)
+	for (int i = 0; i < lanes; i += 8) {
+		const __m256i va = _mm256_cvtepi16_epi32(_mm_load_si128((const __m128i*)(a + i)));
+		const __m256i vb = _mm256_cvtepi16_epi32(_mm_load_si128((const __m128i*)(b + i)));
+		_mm256_storeu_si256((__m256i*)(products + i), _mm256_mullo_epi32(va, vb));
+	}
+#elif defined(GTE_SSE2)
+	for (int i = 0; i < lanes; i += 8) {
+		const __m128i va = _mm_load_si128((const __m128i*)(a + i));
+		const __m128i vb = _mm_load_si128((const __m128i*)(b + i));
+		const __m128i low = _mm_mullo_epi16(va, vb);
+		const __m128i high = _mm_mulhi_epi16(va, vb);
+		_mm_storeu_si128((__m128i*)(products + i), _mm_unpacklo_epi16(low, high));
+		_mm_storeu_si128((__m128i*)(products + i + 4), _mm_unpackhi_epi16(low, high));
+	}
+#else
+	for (int i = 0; i < lanes; i++) {
+		products[i] = (i32)a[i] * (i32)b[i];
+	}
+#endif
+}
+
+
+//	Flags and saturation
+
+//	MAC1..3 are 44 bit wide internally
+i64 GTE::checkMAC(u8 index, i64 value) {
+	if (value > 0x7ff'ffff'ffffLL) {
+		flag |= FLAG_MAC_POSITIVE(index);
+	}
+	else if (value < -0x800'0000'0000LL) {
+		flag |= FLAG_MAC_NEGATIVE(index);
+	}
+	return (i64)((u64)value << 20) >> 20;
+}
+
+void GTE::checkMAC0(i64 value) {
+	if (value > 0x7fff'ffffLL) {
+		flag |= FLAG_MAC0_POSITIVE;
+	}
+	else if (value < -0x8000'0000LL) {
+		flag |= FLAG_MAC0_NEGATIVE;
+	}
+}
+
+void GTE::setMAC(u8 index, i64 value, u8 shift) {
+	if (index == 0) {
+		checkMAC0(value);
+	}
+	else {
+		checkMAC(index, value);
+	}
+	data[MAC0 + index] = (u32)(value >> shift);
+}
+
+void GTE::setIR(u8 index, i32 value, bool lm) {
+	const i32 min = (index == 0 || lm) ? 0 : -0x8000;
+	const i32 max = (index == 0) ? 0x1000 : 0x7fff;
+	if (value < min) {
+		value = min;
+		flag |= (index == 0) ? FLAG_IR0 : FLAG_IR(index);
+	}
+	else if (value > max) {
+		value = max;
+		flag |= (index == 0) ? FLAG_IR0 : FLAG_IR(index);
+	}
+	data[IR0 + index] = (u32)value;
+}
+
+void GTE::setMACAndIR(u8 index, i64 value, u8 shift, bool lm) {
+	setMAC(index, value, shift);
+	setIR(index, (i32)data[MAC0 + index], lm);
+}
+
+void GTE::pushSZ(i32 value) {
+	if (value < 0) {
+		value = 0;
+		flag |= FLAG_SZ3_OTZ;
+	}
+	else if (value > 0xffff) {
+		value = 0xffff;
+		flag |= FLAG_SZ3_OTZ;
+	}
+	data[SZ0] = data[SZ0 + 1];
+	data[SZ0 + 1] = data[SZ0 + 2];
+	data[SZ0 + 2] = data[SZ0 + 3];
+	data[SZ0 + 3] = (u32)value;
+}
+
+void GTE::pushSXY(i32 x, i32 y) {
+	if (x < -0x400) {
+		x = -0x400;
+		flag |= FLAG_SX2;
+	}
+	else if (x > 0x3ff) {
+		x = 0x3ff;
+		flag |= FLAG_SX2;
+	}
+	if (y < -0x400) {
+		y = -0x400;
+		flag |= FLAG_SY2;
+	}
+	else if (y > 0x3ff) {
+		y = 0x3ff;
+		flag |= FLAG_SY2;
+	}
+	data[SXY0] = data[SXY0 + 1];
+	data[SXY0 + 1] = data[SXY0 + 2];
+	data[SXY0 + 2] = ((u32)x & 0xffff) | ((u32)y << 16);
+}
+
+//	color FIFO gets MAC1..3 / 16, saturated to 0..FFh, CODE comes from RGBC
+void GTE::pushColor() {
+	u32 color = data[RGBC] & 0xff00'0000;
+	for (u8 i = 1; i <= 3; i++) {
+		i32 c = (i32)data[MAC0 + i] >> 4;
+		if (c < 0) {
+			c = 0;
+			flag |= FLAG_COLOR(i);
+		}
+		else if (c > 0xff) {
+			c = 0xff;
+			flag |= FLAG_COLOR(i);
+		}
+		color |= (u32)c << ((i - 1) * 8);
+	}
+	data[RGB0] = data[RGB0 + 1];
+	data[RGB0 + 1] = data[RGB0 + 2];
+	data[RGB0 + 2] = color;
+}
+
+//	H / SZ3 as the hardware does it (Newton-Raphson with the UNR table), 0..1FFFFh
+u32 GTE::divide(u16 h, u16 sz3) {
+	if (h >= (u32)sz3 * 2) {
+		flag |= FLAG_DIVIDE;
+		return 0x1ffff;
+	}
+
+	u32 z = 0;
+	while (z < 16 && !(sz3 & (0x8000 >> z))) {
+		z++;
+	}
+	const u64 n = (u64)h << z;
+	u32 d = (u32)sz3 << z;
+	const u32 u = unrTable.values[(d - 0x7fc0) >> 7] + 0x101;
+	d = (0x200'0080 - (d * u)) >> 8;
+	d = (0x000'0080 + (d * u)) >> 8;
+	return (u32)std::min<u64>(0x1ffff, ((n * d) + 0x8000) >> 16);
+}
+
+
+//	Shared pieces of the commands
+
+//	MAC1..3 = (T * 1000h + M * V) SAR shift, IR1..3 = MAC1..3 saturated
+void GTE::transform(const i32* products, const i32 t[3], u8 shift, bool lm) {
+	for (u8 i = 0; i < 3; i++) {
+		i64 value = checkMAC(i + 1, ((i64)t[i] << 12) + products[i * 3]);
+		value = checkMAC(i + 1, value + products[i * 3 + 1]);
+		setMACAndIR(i + 1, value + products[i * 3 + 2], shift, lm);
+	}
+}
+
+//	MVMVA with the FC vector: the first column only shows up in the flags
+void GTE::transformBuggy(const Matrix m, const i32 t[3], const Vector v, u8 shift, bool lm) {
+	for (u8 i = 0; i < 3; i++) {
+		const i64 first = checkMAC(i + 1, ((i64)t[i] << 12) + (i32)m[i * 3] * v[0]);
+		setIR(i + 1, (i32)(first >> shift), false);
+		const i64 value = checkMAC(i + 1, (i64)((i32)m[i * 3 + 1] * v[1]));
+		setMACAndIR(i + 1, value + (i32)m[i * 3 + 2] * v[2], shift, lm);
+	}
+}
+
+//	RTPS for one vertex, products are RT * V
+void GTE::perspective(const i32* products, u8 shift, bool lm, bool last) {
+	const i32 tr[3] = { (i32)control[TR], (i32)control[TR + 1], (i32)control[TR + 2] };
+	i64 mac[3];
+	for (u8 i = 0; i < 3; i++) {
+		i64 value = checkMAC(i + 1, ((i64)tr[i] << 12) + products[i * 3]);
+		value = checkMAC(i + 1, value + products[i * 3 + 1]);
+		mac[i] = value + products[i * 3 + 2];
+		setMAC(i + 1, mac[i], shift);
+	}
+	setIR(1, (i32)data[MAC0 + 1], lm);
+	setIR(2, (i32)data[MAC0 + 2], lm);
+
+	//	with sf = 0 the IR3 saturation flag looks at MAC3 SAR 12, while IR3 itself is saturated from MAC3
+	if (shift == 0) {
+		const i64 z = mac[2] >> 12;
+		if (z < -0x8000 || z > 0x7fff) {
+			flag |= FLAG_IR(3);
+		}
+		data[IR0 + 3] = (u32)std::clamp((i32)data[MAC0 + 3], lm ? 0 : -0x8000, 0x7fff);
+	}
+	else {
+		setIR(3, (i32)data[MAC0 + 3], lm);
+	}
+
+	pushSZ((i32)(mac[2] >> 12));
+
+	const i64 projection = divide((u16)control[H], (u16)data[SZ0 + 3]);
+	const i64 sx = projection * lo(data[IR0 + 1]) + (i32)control[OFX];
+	const i64 sy = projection * lo(data[IR0 + 2]) + (i32)control[OFY];
+	checkMAC0(sx);
+	checkMAC0(sy);
+	pushSXY((i32)(sx >> 16), (i32)(sy >> 16));
+
+	//	depth cueing, only for the last vertex
+	if (last) {
+		const i64 depth = projection * (i16)control[DQA] + (i32)control[DQB];
+		setMAC(0, depth, 0);
+		setIR(0, (i32)(depth >> 12), true);
+	}
+}
+
+//	IR1..3 = (BK * 1000h + LCM * IR) SAR shift
+void GTE::lightColor(u8 shift, bool lm) {
+	Matrix lcm;
+	Vector ir;
+	i32 products[32];
+	const i32 bk[3] = { (i32)control[BK], (i32)control[BK + 1], (i32)control[BK + 2] };
+	getMatrix(LCM, lcm);
+	getVector(3, ir);
+	multiply(lcm, &ir, 1, products);
+	transform(products, bk, shift, lm);
+}
+
+//	MAC1..3 = MAC + (FC - MAC) * IR0, then pushed to the color FIFO by the caller
+void GTE::interpolateColor(i64 mac1, i64 mac2, i64 mac3, u8 shift, bool lm) {
+	const i64 in[3] = { mac1, mac2, mac3 };
+	for (u8 i = 0; i < 3; i++) {
+		setMACAndIR(i + 1, ((i64)(i32)control[FC + i] << 12) - in[i], shift, false);
+	}
+	const i64 ir0 = lo(data[IR0]);
+	for (u8 i = 0; i < 3; i++) {
+		setMACAndIR(i + 1, (i64)lo(data[IR0 + 1 + i]) * ir0 + in[i], shift, lm);
+	}
+}
+
+//	NCS / NCCS / NCDS for one vertex, products are LLM * V
+enum { NORMAL_COLOR = 0, NORMAL_COLOR_COLOR = 1, NORMAL_COLOR_DEPTH = 2 };
+void GTE::normalColor(const i32* products, u8 shift, bool lm, u8 mode) {
+	static const i32 zero[3] = { 0, 0, 0 };
+	transform(products, zero, shift, lm);
+	lightColor(shift, lm);
+
+	if (mode != NORMAL_COLOR) {
+		const i64 r = (i64)(data[RGBC] & 0xff) * lo(data[IR0 + 1]) << 4;
+		const i64 g = (i64)((data[RGBC] >> 8) & 0xff) * lo(data[IR0 + 2]) << 4;
+		const i64 b = (i64)((data[RGBC] >> 16) & 0xff) * lo(data[IR0 + 3]) << 4;
+		if (mode == NORMAL_COLOR_DEPTH) {
+			interpolateColor(r, g, b, shift, lm);
+		}
+		else {
+			setMAC(1, r, 0);
+			setMAC(2, g, 0);
+			setMAC(3, b, 0);
+			for (u8 i = 1; i <= 3; i++) {
+				setMACAndIR(i, (i32)data[MAC0 + i], shift, lm);
+			}
+		}
+	}
+	pushColor();
+}
+
+
+//	Commands
+
+void GTE::RTPS(word c) {
+	Matrix rt;
+	Vector v;
+	i32 products[32];
+	getMatrix(RT, rt);
+	getVector(0, v);
+	multiply(rt, &v, 1, products);
+	perspective(products, GTE_SF(c), GTE_LM(c), true);
+}
+
+//	all three vertices are multiplied in one go
+void GTE::RTPT(word c) {
+	Matrix rt;
+	Vector v[3];
+	i32 products[32];
+	getMatrix(RT, rt);
+	for (u8 i = 0; i < 3; i++) {
+		getVector(i, v[i]);
+	}
+	multiply(rt, v, 3, products);
+	for (u8 i = 0; i < 3; i++) {
+		perspective(products + i * 9, GTE_SF(c), GTE_LM(c), i == 2);
+	}
+}
+
+void GTE::NCLIP(word) {
+	const i64 x0 = lo(data[SXY0]), y0 = hi(data[SXY0]);
+	const i64 x1 = lo(data[SXY0 + 1]), y1 = hi(data[SXY0 + 1]);
+	const i64 x2 = lo(data[SXY0 + 2]), y2 = hi(data[SXY0 + 2]);
+	setMAC(0, x0 * y1 + x1 * y2 + x2 * y0 - x0 * y2 - x1 * y0 - x2 * y1, 0);
+}
+
+//	outer product of IR and the RT diagonal
+void GTE::OP(word c) {
+	const i64 d1 = lo(control[RT]), d2 = lo(control[RT + 2]), d3 = lo(control[RT + 4]);
+	const i64 ir1 = lo(data[IR0 + 1]), ir2 = lo(data[IR0 + 2]), ir3 = lo(data[IR0 + 3]);
+	setMACAndIR(1, ir3 * d2 - ir2 * d3, GTE_SF(c), GTE_LM(c));
+	setMACAndIR(2, ir1 * d3 - ir3 * d1, GTE_SF(c), GTE_LM(c));
+	setMACAndIR(3, ir2 * d1 - ir1 * d2, GTE_SF(c), GTE_LM(c));
+}
+
+void GTE::DPCS(word c) {
+	const u32 rgb = data[RGBC];
+	interpolateColor((i64)(rgb & 0xff) << 16, (i64)((rgb >> 8) & 0xff) << 16, (i64)((rgb >> 16) & 0xff) << 16, GTE_SF(c), GTE_LM(c));
+	pushColor();
+}
+
+//	DPCS on the three FIFO colors, RGB0 is the next one every time
+void GTE::DPCT(word c) {
+	for (int i = 0; i < 3; i++) {
+		const u32 rgb = data[RGB0];
+		interpolateColor((i64)(rgb & 0xff) << 16, (i64)((rgb >> 8) & 0xff) << 16, (i64)((rgb >> 16) & 0xff) << 16, GTE_SF(c), GTE_LM(c));
+		pushColor();
+	}
+}
+
+void GTE::INTPL(word c) {
+	interpolateColor((i64)lo(data[IR0 + 1]) << 12, (i64)lo(data[IR0 + 2]) << 12, (i64)lo(data[IR0 + 3]) << 12, GTE_SF(c), GTE_LM(c));
+	pushColor();
+}
+
+void GTE::MVMVA(word c) {
+	Matrix m;
+	Vector v;
+	getVector(GTE_V(c), v);
+
+	switch (GTE_MX(c)) {
+		case 0: getMatrix(RT, m); break;
+		case 1: getMatrix(LLM, m); break;
+		case 2: getMatrix(LCM, m); break;
+
+		//	no matrix, the hardware reads garbage
+		default: {
+			const i16 r = (i16)((data[RGBC] & 0xff) << 4);
+			const i16 rt13 = lo(control[RT + 1]);
+			const i16 rt22 = lo(control[RT + 2]);
+			const Matrix garbage = { (i16)-r, r, lo(data[IR0]), rt13, rt13, rt13, rt22, rt22, rt22 };
+			memcpy(m, garbage, sizeof(Matrix));
+			break;
+		}
+	}
+
+	i32 t[3] = { 0, 0, 0 };
+	const u8 cv = GTE_CV(c);
+	if (cv != 3) {
+		const u8 base = (cv == 0) ? TR : (cv == 1) ? BK : FC;
+		for (u8 i = 0; i < 3; i++) {
+			t[i] = (i32)control[base + i];
+		}
+	}
+
+	if (cv == 2) {
+		transformBuggy(m, t, v, GTE_SF(c), GTE_LM(c));
+	}
+	else {
+		i32 products[32];
+		multiply(m, &v, 1, products);
+		transform(products, t, GTE_SF(c), GTE_LM(c));
+	}
+}
+
+void GTE::NCS(word c) {
+	Matrix llm;
+	Vector v;
+	i32 products[32];
+	getMatrix(LLM, llm);
+	getVector(0, v);
+	multiply(llm, &v, 1, products);
+	normalColor(products, GTE_SF(c), GTE_LM(c), NORMAL_COLOR);
+}
+
+//	the light matrix products of all three normals are done in one SIMD pass
+void GTE::normalColorTriple(word c, u8 mode) {
+	Matrix llm;
+	Vector v[3];
+	i32 products[32];
+	getMatrix(LLM, llm);
+	for (u8 i = 0; i < 3; i++) {
+		getVector(i, v[i]);
+	}
+	multiply(llm, v, 3, products);
+	for (u8 i = 0; i < 3; i++) {
+		normalColor(products + i * 9, GTE_SF(c), GTE_LM(c), mode);
+	}
+}
+
+void GTE::NCT(word c) {
+	normalColorTriple(c, NORMAL_COLOR);
+}
+
+void GTE::NCCS(word c) {
+	Matrix llm;
+	Vector v;
+	i32 products[32];
+	getMatrix(LLM, llm);
+	getVector(0, v);
+	multiply(llm, &v, 1, products);
+	normalColor(products, GTE_SF(c), GTE_LM(c), NORMAL_COLOR_COLOR);
+}
+
+void GTE::NCCT(word c) {
+	normalColorTriple(c, NORMAL_COLOR_COLOR);
+}
+
+void GTE::NCDS(word c) {
+	Matrix llm;
+	Vector v;
+	i32 products[32];
+	getMatrix(LLM, llm);
+	getVector(0, v);
+	multiply(llm, &v, 1, products);
+	normalColor(products, GTE_SF(c), GTE_LM(c), NORMAL_COLOR_DEPTH);
+}
+
+void GTE::NCDT(word c) {
+	normalColorTriple(c, NORMAL_COLOR_DEPTH);
+}
+
+void GTE::CC(word c) {
+	lightColor(GTE_SF(c), GTE_LM(c));
+	const u32 rgb = data[RGBC];
+	setMAC(1, (i64)(rgb & 0xff) * lo(data[IR0 + 1]) << 4, 0);
+	setMAC(2, (i64)((rgb >> 8) & 0xff) * lo(data[IR0 + 2]) << 4, 0);
+	setMAC(3, (i64)((rgb >> 16) & 0xff) * lo(data[IR0 + 3]) << 4, 0);
+	for (u8 i = 1; i <= 3; i++) {
+		setMACAndIR(i, (i32)data[MAC0 + i], GTE_SF(c), GTE_LM(c));
+	}
+	pushColor();
+}
+
+void GTE::CDP(word c) {
+	lightColor(GTE_SF(c), GTE_LM(c));
+	const u32 rgb = data[RGBC];
+	interpolateColor((i64)(rgb & 0xff) * lo(data[IR0 + 1]) << 4, (i64)((rgb >> 8) & 0xff) * lo(data[IR0 + 2]) << 4, (i64)((rgb >> 16) & 0xff) * lo(data[IR0 + 3]) << 4, GTE_SF(c), GTE_LM(c));
+	pushColor();
+}
+
+void GTE::DCPL(word c) {
+	const u32 rgb = data[RGBC];
+	interpolateColor((i64)(rgb & 0xff) * lo(data[IR0 + 1]) << 4, (i64)((rgb >> 8) & 0xff) * lo(data[IR0 + 2]) << 4, (i64)((rgb >> 16) & 0xff) * lo(data[IR0 + 3]) << 4, GTE_SF(c), GTE_LM(c));
+	pushColor();
+}
+
+void GTE::SQR(word c) {
+	for (u8 i = 1; i <= 3; i++) {
+		const i64 ir = lo(data[IR0 + i]);
+		setMACAndIR(i, ir * ir, GTE_SF(c), GTE_LM(c));
+	}
+}
+
+//	average Z for the ordering table
+void GTE::AVSZ3(word) {
+	const i64 value = (i64)(i16)control[ZSF3] * (i64)(data[SZ0 + 1] + data[SZ0 + 2] + data[SZ0 + 3]);
+	setMAC(0, value, 0);
+	data[OTZ] = (u32)std::clamp<i64>(value >> 12, 0, 0xffff);
+	if ((value >> 12) < 0 || (value >> 12) > 0xffff) {
+		flag |= FLAG_SZ3_OTZ;
+	}
+}
+
+void GTE::AVSZ4(word) {
+	const i64 value = (i64)(i16)control[ZSF4] * (i64)(data[SZ0] + data[SZ0 + 1] + data[SZ0 + 2] + data[SZ0 + 3]);
+	setMAC(0, value, 0);
+	data[OTZ] = (u32)std::clamp<i64>(value >> 12, 0, 0xffff);
+	if ((value >> 12) < 0 || (value >> 12) > 0xffff) {
+		flag |= FLAG_SZ3_OTZ;
+	}
+}
+
+//	general purpose interpolation
+void GTE::GPF(word c) {
+	const i64 ir0 = lo(data[IR0]);
+	for (u8 i = 1; i <= 3; i++) {
+		setMACAndIR(i, ir0 * lo(data[IR0 + i]), GTE_SF(c), GTE_LM(c));
+	}
+	pushColor();
+}
+
+void GTE::GPL(word c) {
+	const i64 ir0 = lo(data[IR0]);
+	const u8 shift = GTE_SF(c);
+	for (u8 i = 1; i <= 3; i++) {
+		setMACAndIR(i, ((i64)(i32)data[MAC0 + i] << shift) + ir0 * lo(data[IR0 + i]), shift, GTE_LM(c));
+	}
+	pushColor();
+}
+
+void GTE::command(word opcode) {
+	flag = 0;
+
+	switch (opcode & 0x3f) {
+		case 0x01: RTPS(opcode); break;
+		case 0x06: NCLIP(opcode); break;
+		case 0x0c: OP(opcode); break;
+		case 0x10: DPCS(opcode); break;
+		case 0x11: INTPL(opcode); break;
+		case 0x12: MVMVA(opcode); break;
+		case 0x13: NCDS(opcode); break;
+		case 0x14: CDP(opcode); break;
+		case 0x16: NCDT(opcode); break;
+		case 0x1b: NCCS(opcode); break;
+		case 0x1c: CC(opcode); break;
+		case 0x1e: NCS(opcode); break;
+		case 0x20: NCT(opcode); break;
+		case 0x28: SQR(opcode); break;
+		case 0x29: DCPL(opcode); break;
+		case 0x2a: DPCT(opcode); break;
+		case 0x2d: AVSZ3(opcode); break;
+		case 0x2e: AVSZ4(opcode); break;
+		case 0x30: RTPT(opcode); break;
+		case 0x3d: GPF(opcode); break;
+		case 0x3e: GPL(opcode); break;
+		case 0x3f: NCCT(opcode); break;
+		default:
+			console->warn("Unknown GTE command {0:02x}", opcode & 0x3f);
+			break;
+	}
+
+	if (flag & FLAG_ERROR_MASK) {
+		flag |= 0x8000'0000;
+	}
+}
@@ -0,0 +1,47 @@
+#pragma once
+#ifndef GTE_GUARD
+#define GTE_GUARD
+#include "defs.h"
+#include "include/spdlog/spdlog.h"
+#include "include/spdlog/sinks/stdout_color_sinks.h"
+
+/*
+	Geometry Transformation Engine (COP2)
+	Data registers are cop2r0-31 (MFC2 / MTC2 / LWC2 / SWC2),
+	control registers cop2r32-63 (CFC2 / CTC2).
+*/
+namespace GTE {
+
+	//	raw register file, for snapshots
+	struct State {
+		u32 data[32];
+		u32 control[32];
+		u32 flag;
+	};
+
+	void init();
+	State saveState();
+	void loadState(const State& state);
+
+	u32 readData(u8 reg);
+	void writeData(u8 reg, u32 data);
+	u32 readControl(u8 reg);
+	void writeControl(u8 reg, u32 data);
+
+	//	COP2 imm25 command (RTPS, NCLIP, MVMVA, ...)
+	void command(word opcode);
+
+	//	cycles per command, indexed by funct
+	constexpr u8 COMMAND_CYCLES[64] = {
+		1, 15, 1, 1, 1, 1, 8, 1,
+		1, 1, 1, 1, 6, 1, 1, 1,
+		8, 8, 8, 19, 13, 1, 44, 1,
+		1, 1, 1, 17, 11, 1, 14, 1,
+		30, 1, 1, 1, 1, 1, 1, 1,
+		5, 8, 17, 1, 1, 5, 6, 1,
+		23, 1, 1, 1, 1, 1, 1, 1,
+		1, 1, 1, 1, 1, 5, 5, 39,
+	};
+}
+
+#endif
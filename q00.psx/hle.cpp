@@ -0,0 +1,221 @@
+#include "hle.h"
+#include "cpu.h"
+#include "mmu.h"
+#include "timer.h"
+#include "blockcache.h"
+#include <string.h>
+#define HLE_CYCLES_CALL 16		//	A0h / B0h / C0h dispatcher, function prologue and return
+#define HLE_CYCLES_PER_BYTE 6	//	one iteration of the BIOS byte loops (lbu / sb, two addiu, branch)
+
+static auto console = spdlog::stdout_color_mt("HLE");
+
+namespace HLE {
+	bool enabled = false;
+
+	//	returns false if the BIOS should run the call itself, cycles starts out at HLE_CYCLES_CALL
+	typedef bool (*Function)(u32& cycles);
+
+	Function aFunctions[0x100] = { nullptr };
+	Function bFunctions[0x100] = { nullptr };
+	Function cFunctions[0x100] = { nullptr };
+
+	u32& arg(u8 n) { return R3000A::registers.r[4 + n]; }
+	u32& result() { return R3000A::registers.r[2]; }
+
+	//	host pointer to [address, address + size) if all of it is in main RAM
+	u8* ramPointer(word address, word size) {
+		address = MASKED_ADDRESS(address);
+		if (address >= RAM_SIZE || size > RAM_SIZE - address) {
+			return nullptr;
+		}
+		return &Memory::memory[address];
+	}
+
+	//	length of the string at address, -1 if it isn't terminated inside of main RAM
+	i32 stringLength(word address) {
+		const u8* start = ramPointer(address, 1);
+		if (!start) {
+			return -1;
+		}
+		const u8* end = (const u8*)memchr(start, 0, RAM_SIZE - MASKED_ADDRESS(address));
+		return end ? (i32)(end - start) : -1;
+	}
+
+	//	host side writes bypass Memory::store, so they have to do its bookkeeping
+	bool beginWrite() {
+		return !R3000A::cop[0].sr.flags.isolate_cache;
+	}
+
+	void endWrite(word address, word size) {
+		Memory::wrote(MASKED_ADDRESS(address), size);
+	}
+
+	//	the BIOS copies forwards byte by byte, overlapping copies repeat the source pattern
+	void copyForward(u8* dst, const u8* src, i32 length) {
+		if (dst > src && dst < src + length) {
+			for (i32 i = 0; i < length; i++) {
+				dst[i] = src[i];
+			}
+		}
+		else {
+			memmove(dst, src, length);
+		}
+	}
+
+
+	//	A(17h) strcmp(str1, str2)
+	bool A_strcmp(u32& cycles) {
+		const i32 length1 = stringLength(arg(0));
+		const i32 length2 = stringLength(arg(1));
+		if (!arg(0) || !arg(1) || length1 < 0 || length2 < 0) {
+			return false;
+		}
+		const i8* s1 = (const i8*)ramPointer(arg(0), length1 + 1);
+		const i8* s2 = (const i8*)ramPointer(arg(1), length2 + 1);
+		i32 i = 0;
+		while (s1[i] && s1[i] == s2[i]) {
+			i++;
+		}
+		result() = (u32)(s1[i] - s2[i]);	//	difference of the first mismatching (signed) chars
+		cycles += HLE_CYCLES_PER_BYTE * (i + 1);
+		return true;
+	}
+
+	//	A(19h) strcpy(dst, src)
+	bool A_strcpy(u32& cycles) {
+		const i32 length = stringLength(arg(1));
+		if (!arg(0) || !arg(1) || length < 0 || !beginWrite()) {
+			return false;
+		}
+		u8* dst = ramPointer(arg(0), length + 1);
+		if (!dst) {
+			return false;
+		}
+		copyForward(dst, ramPointer(arg(1), length + 1), length + 1);
+		endWrite(arg(0), length + 1);
+		result() = arg(0);
+		cycles += HLE_CYCLES_PER_BYTE * (length + 1);
+		return true;
+	}
+
+	//	A(1Bh) strlen(src)
+	bool A_strlen(u32& cycles) {
+		const i32 length = stringLength(arg(0));
+		if (!arg(0) || length < 0) {
+			return false;
+		}
+		result() = length;
+		cycles += HLE_CYCLES_PER_BYTE * (length + 1);
+		return true;
+	}
+
+	//	A(28h) bzero(dst, len)
+	bool A_bzero(u32& cycles) {
+		const i32 length = (i32)arg(1);
+		u8* dst = ramPointer(arg(0), length);
+		if (!arg(0) || length <= 0 || !dst || !beginWrite()) {
+			return false;
+		}
+		memset(dst, 0, length);
+		endWrite(arg(0), length);
+		result() = arg(0);
+		cycles += HLE_CYCLES_PER_BYTE * length;
+		return true;
+	}
+
+	//	A(2Ah) memcpy(dst, src, len)
+	bool A_memcpy(u32& cycles) {
+		const i32 length = (i32)arg(2);
+		u8* dst = ramPointer(arg(0), length);
+		const u8* src = ramPointer(arg(1), length);
+		if (!arg(0) || length <= 0 || !dst || !src || !beginWrite()) {
+			return false;
+		}
+		copyForward(dst, src, length);
+		endWrite(arg(0), length);
+		result() = arg(0);
+		cycles += HLE_CYCLES_PER_BYTE * length;
+		return true;
+	}
+
+	//	A(2Bh) memset(dst, fillbyte, len)
+	bool A_memset(u32& cycles) {
+		const i32 length = (i32)arg(2);
+		u8* dst = ramPointer(arg(0), length);
+		if (!arg(0) || length <= 0 || !dst || !beginWrite()) {
+			return false;
+		}
+		memset(dst, (u8)arg(1), length);
+		endWrite(arg(0), length);
+		result() = arg(0);
+		cycles += HLE_CYCLES_PER_BYTE * length;
+		return true;
+	}
+
+	//	B(03h) get_timer(t)
+	bool B_get_timer(u32&) {
+		if (arg(0) >= 3) {
+			return false;
+		}
+		result() = Timer::readCurrentCounter(arg(0)) & 0xffff;
+		return true;
+	}
+
+	//	B(04h) enable_timer_irq(t) / B(05h) disable_timer_irq(t), IRQ4..6 for the root counters, IRQ0 (vblank) for t = 3
+	u32 timerIRQ(u32 timer) {
+		return (timer < 3) ? (0x10 << timer) : 1;
+	}
+
+	bool B_enable_timer_irq(u32&) {
+		if (arg(0) > 3) {
+			return false;
+		}
+		Memory::I_MASK.raw |= timerIRQ(arg(0));
+		result() = 1;
+		return true;
+	}
+
+	bool B_disable_timer_irq(u32&) {
+		if (arg(0) > 3) {
+			return false;
+		}
+		Memory::I_MASK.raw &= ~timerIRQ(arg(0));
+		result() = 1;
+		return true;
+	}
+}
+
+void HLE::init() {
+	aFunctions[0x17] = A_strcmp;
+	aFunctions[0x19] = A_strcpy;
+	aFunctions[0x1b] = A_strlen;
+	aFunctions[0x28] = A_bzero;
+	aFunctions[0x2a] = A_memcpy;
+	aFunctions[0x2b] = A_memset;
+
+	bFunctions[0x03] = B_get_timer;
+	bFunctions[0x04] = B_enable_timer_irq;
+	bFunctions[0x05] = B_disable_timer_irq;
+
+	console->info("HLE init");
+}
+
+//	address is 0xa0, 0xb0 or 0xc0, returns the cycles used or 0 if the BIOS has to handle the call
+u32 HLE::dispatch(word address) {
+	const u32 id = R3000A::registers.r[9];
+	if (id >= 0x100) {
+		return 0;
+	}
+
+	Function function = (address == 0xa0) ? aFunctions[id] : (address == 0xb0) ? bFunctions[id] : cFunctions[id];
+	u32 cycles = HLE_CYCLES_CALL;
+	if (!function || !function(cycles)) {
+		return 0;
+	}
+
+	//	return to the caller
+	R3000A::registers.pc = R3000A::registers.r[31];
+	R3000A::registers.next_pc = R3000A::registers.pc + 4;
+	R3000A::cycles += cycles;
+	return cycles;
+}
@@ -0,0 +1,36 @@
+#pragma once
+#ifndef HLE_GUARD
+#define HLE_GUARD
+#include "defs.h"
+#include "include/spdlog/spdlog.h"
+#include "include/spdlog/sinks/stdout_color_sinks.h"
+#define MASKED_ADDRESS(a) (a & 0x1fff'ffff)
+
+/*
+	Native implementations of hot BIOS functions (A0h / B0h / C0h calls, function id in r9).
+	Opt-in with --hle. A call that is handled here never enters the BIOS code: the result
+	goes to r2, execution continues at ra and the cycles the BIOS routine would have taken
+	are charged. Anything unusual (null pointers, memory outside of main RAM, ..) falls back
+	to the real BIOS code.
+*/
+namespace HLE {
+
+	extern bool enabled;
+
+	void init();
+	u32 dispatch(word address);
+
+	//	called with pc before an instruction / block is executed, returns the cycles used or 0
+	inline u32 call(word address) {
+		if (!enabled) {
+			return 0;
+		}
+		address = MASKED_ADDRESS(address);
+		if (address != 0xa0 && address != 0xb0 && address != 0xc0) {
+			return 0;
+		}
+		return dispatch(address);
+	}
+}
+
+#endif
@@ -0,0 +1,50 @@
+#include "io.h"
+#include "mmu.h"
+#include "gpu.h"
+#include "dma.h"
+#include "spu.h"
+#include "timer.h"
+#include <mutex>
+
+namespace IO {
+	Port ports[IO_SIZE] = {};
+}
+
+void IO::init() {
+	static std::once_flag once;
+	std::call_once(once, [] {
+		Memory::mapIO();
+		GPU::mapIO();
+		DMA::mapIO();
+		SPU::mapIO();
+		Timer::mapIO();
+	});
+}
+
+void IO::mapRead(word address, ReadHandler handler, u8 widths) {
+	mapReadRange(address, address + 1, handler, widths);
+}
+
+void IO::mapWrite(word address, WriteHandler handler, u8 widths) {
+	mapWriteRange(address, address + 1, handler, widths);
+}
+
+void IO::mapReadRange(word start, word end, ReadHandler handler, u8 widths) {
+	for (word address = start; address < end; address++) {
+		for (u8 width = 0; width < 3; width++) {
+			if (widths & (1 << width)) {
+				ports[address - IO_START].read[width] = handler;
+			}
+		}
+	}
+}
+
+void IO::mapWriteRange(word start, word end, WriteHandler handler, u8 widths) {
+	for (word address = start; address < end; address++) {
+		for (u8 width = 0; width < 3; width++) {
+			if (widths & (1 << width)) {
+				ports[address - IO_START].write[width] = handler;
+			}
+		}
+	}
+}
@@ -0,0 +1,54 @@
+#pragma once
+#ifndef IO_GUARD
+#define IO_GUARD
+#include "defs.h"
+#define IO_START 0x1f80'1000
+#define IO_SIZE 0x1000
+#define IO_WIDTH_INDEX(size) (size >> 1)	//	access size 1 / 2 / 4 -> 0 / 1 / 2
+
+/*
+	I/O port dispatch. Every subsystem registers read / write handlers for its registers (per
+	access width) in mapIO, they end up in a table indexed by the offset into the I/O ports,
+	so Memory::fetch / store find them with a single lookup.
+	Handlers get the full (masked) address and are the same for every instance, the state
+	they work on is the calling thread's. Offsets nobody registered read back the I/O register
+	file and drop writes. A later registration replaces an earlier one, so catch-all handlers
+	for a range go first.
+*/
+namespace IO {
+
+	typedef u32 (*ReadHandler)(word address);
+	typedef void (*WriteHandler)(word address, u32 data);
+
+	enum Width : u8 {
+		Byte = 1 << IO_WIDTH_INDEX(1),
+		Half = 1 << IO_WIDTH_INDEX(2),
+		Word = 1 << IO_WIDTH_INDEX(4),
+		AnyWidth = Byte | Half | Word
+	};
+
+	struct Port {
+		ReadHandler read[3];
+		WriteHandler write[3];
+	};
+	extern Port ports[IO_SIZE];
+
+	void init();	//	once per process
+
+	void mapRead(word address, ReadHandler handler, u8 widths = AnyWidth);
+	void mapWrite(word address, WriteHandler handler, u8 widths = AnyWidth);
+	void mapReadRange(word start, word end, ReadHandler handler, u8 widths = AnyWidth);
+	void mapWriteRange(word start, word end, WriteHandler handler, u8 widths = AnyWidth);
+
+	template <typename T>
+	inline ReadHandler reader(word address) {
+		return ports[address - IO_START].read[IO_WIDTH_INDEX(sizeof(T))];
+	}
+
+	template <typename T>
+	inline WriteHandler writer(word address) {
+		return ports[address - IO_START].write[IO_WIDTH_INDEX(sizeof(T))];
+	}
+}
+
+#endif
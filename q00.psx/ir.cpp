@@ -0,0 +1,546 @@
+#include "ir.h"
+#include "blockcache.h"
+#include "mmu.h"
+#define CPU R3000A
+#define PRIMARY_OPCODE(opcode) (opcode >> 26)
+#define SECONDARY_OPCODE(opcode) (opcode & 0x3f)
+#define GPR_BIT(r) ((u32)1 << (r))
+#define ALL_GPRS 0xffff'ffff
+
+using R3000A::Instruction;
+
+namespace IR {
+	bool optimize = true;
+
+	//	what an instruction does to the GPRs
+	struct Effects {
+		u32 reads = 0;
+		u8 writes = 0;			//	0 if it doesn't write a GPR (or only r0)
+		bool pure = false;		//	nothing else than that write, so it can be folded / dropped
+		bool exit = false;		//	the block may be left right after it, every register has to be exact there
+	};
+
+	Effects effects(const Instruction& instr);
+	bool fold(const Instruction& instr, const u32* values, u32& result);
+	bool lowerALU(const Instruction& instr, Op& op);
+	bool lowerMemory(const Instruction& instr, u32 base, Op& op);
+	void fuse(std::vector<Op>& ops);
+}
+
+//	IR handlers, none of them has to clear r[0] afterwards, rd is never 0
+
+static void guestHandler(const IR::Op& op) {
+	op.instr->handler(*op.instr);
+}
+
+static void nopHandler(const IR::Op&) {
+}
+
+static void constHandler(const IR::Op& op) {
+	CPU::registers.r[op.rd] = op.value;
+}
+
+template<typename T, bool signExtend>
+static inline u32 loaded(T data) {
+	if constexpr (signExtend) {
+		return (sizeof(T) == sizeof(u8)) ? SIGN_EXT_BYTE_TO_WORD(data) : SIGN_EXT_HWORD_TO_WORD(data);
+	}
+	else {
+		return data;
+	}
+}
+
+template<typename T, bool signExtend>
+static void loadRAMHandler(const IR::Op& op) {
+	CPU::registers.r[op.rd] = loaded<T, signExtend>(Memory::readFromMemory<T>(op.value));
+}
+
+template<typename T>
+static void storeRAMHandler(const IR::Op& op) {
+	Memory::storeRAM<T>(op.value, (T)CPU::registers.r[op.rt]);
+}
+
+template<typename T, bool signExtend>
+static void loadScratchpadHandler(const IR::Op& op) {
+	CPU::registers.r[op.rd] = loaded<T, signExtend>(Memory::readScratchpad<T>(op.value));
+}
+
+template<typename T>
+static void storeScratchpadHandler(const IR::Op& op) {
+	Memory::storeScratchpad<T>(op.value, (T)CPU::registers.r[op.rt]);
+}
+
+
+/*
+	Superinstructions, op and the one after it in a single handler.
+	The second half never follows a branch, so it just steps pc like the cached interpreter would.
+*/
+
+static inline void advance(const IR::Op& next) {
+	CPU::registers.log_pc = next.address;
+	CPU::registers.pc = CPU::registers.next_pc;
+	CPU::registers.next_pc += 4;
+}
+
+//	constant builds (LUI / ORI pairs that both stay live, runs of LUIs)
+static void fusedConstConst(const IR::Op& op) {
+	const IR::Op& next = (&op)[1];
+	CPU::registers.r[op.rd] = op.value;
+	advance(next);
+	CPU::registers.r[next.rd] = next.value;
+}
+
+//	LUI / Lx, absolute loads outside of main RAM (I/O registers)
+template<typename T, bool signExtend>
+static void fusedConstLoad(const IR::Op& op) {
+	const IR::Op& next = (&op)[1];
+	CPU::registers.r[op.rd] = op.value;
+	advance(next);
+	const T data = Memory::fetch<T>(next.value);
+	if constexpr (signExtend) {
+		CPU::registers.r[next.rt] = (sizeof(T) == sizeof(u8)) ? SIGN_EXT_BYTE_TO_WORD(data) : SIGN_EXT_HWORD_TO_WORD(data);
+	}
+	else {
+		CPU::registers.r[next.rt] = data;
+	}
+}
+
+//	SLT / SLTU / SLTI / SLTIU and a BEQ / BNE of the result against r0
+template<u8 compare, bool branchIfSet>
+static void fusedCompareBranch(const IR::Op& op) {
+	const IR::Op& next = (&op)[1];
+	u32 set;
+	if constexpr (compare == 0x2a) {
+		set = ((i32)CPU::registers.r[op.rs] < (i32)CPU::registers.r[op.rt]) ? 1 : 0;
+	}
+	else if constexpr (compare == 0x2b) {
+		set = (CPU::registers.r[op.rs] < CPU::registers.r[op.rt]) ? 1 : 0;
+	}
+	else if constexpr (compare == 0x0a) {
+		set = ((i32)CPU::registers.r[op.rs] < (i32)op.value) ? 1 : 0;
+	}
+	else {
+		set = (CPU::registers.r[op.rs] < op.value) ? 1 : 0;
+	}
+	CPU::registers.r[op.rd] = set;
+	advance(next);
+	if ((set != 0) == branchIfSet) {
+		CPU::registers.next_pc = next.value;
+	}
+}
+
+//	ADDIU sp, sp, imm / SW rt, offset(sp), function prologues
+static void fusedStackStore(const IR::Op& op) {
+	const IR::Op& next = (&op)[1];
+	CPU::registers.r[29] += op.value;
+	advance(next);
+	Memory::store<word>(CPU::registers.r[29] + next.value, CPU::registers.r[next.rt]);
+}
+
+template<u8 compare>
+static IR::Handler compareBranchHandler(bool branchIfSet) {
+	return branchIfSet ? fusedCompareBranch<compare, true> : fusedCompareBranch<compare, false>;
+}
+
+
+IR::Effects IR::effects(const Instruction& instr) {
+	const word opcode = instr.opcode;
+	const u32 rs = GPR_BIT(instr.rs);
+	const u32 rt = GPR_BIT(instr.rt);
+	Effects e;
+
+	switch (PRIMARY_OPCODE(opcode)) {
+		case 0x00: {
+			const u8 funct = SECONDARY_OPCODE(opcode);
+			if (funct == 0x00 || funct == 0x02 || funct == 0x03) {
+				e.reads = rt; e.writes = instr.rd; e.pure = true;
+			}
+			else if (funct == 0x04 || funct == 0x06 || funct == 0x07) {
+				e.reads = rt | rs; e.writes = instr.rd; e.pure = true;
+			}
+			else if (funct == 0x08) {
+				e.reads = rs;
+			}
+			else if (funct == 0x09) {
+				e.reads = rs; e.writes = instr.rd;
+			}
+			else if (funct == 0x10 || funct == 0x12) {
+				e.writes = instr.rd; e.pure = true;
+			}
+			else if (funct == 0x11 || funct == 0x13 || (funct >= 0x18 && funct <= 0x1b)) {
+				e.reads = rs | rt;
+			}
+			else if ((funct >= 0x20 && funct <= 0x27) || funct == 0x2a || funct == 0x2b) {
+				e.reads = rs | rt; e.writes = instr.rd; e.pure = true;
+			}
+			else {
+				e.reads = ALL_GPRS;
+			}
+			break;
+		}
+		case 0x01:
+			e.reads = rs;
+			if (instr.rt == 0x10 || instr.rt == 0x11) {
+				e.writes = 31;
+			}
+			break;
+		case 0x02:
+			break;
+		case 0x03:
+			e.writes = 31;
+			break;
+		case 0x04:
+		case 0x05:
+			e.reads = rs | rt;
+			break;
+		case 0x06:
+		case 0x07:
+			e.reads = rs;
+			break;
+		case 0x0f:
+			e.writes = instr.rt; e.pure = true;
+			break;
+		case 0x10:
+		case 0x12:
+			if (opcode & (1 << 25)) {
+				break;
+			}
+			if (instr.rs == 0x00 || instr.rs == 0x02) {
+				e.writes = instr.rt;
+			}
+			else if (instr.rs == 0x04 || instr.rs == 0x06) {
+				e.reads = rt;
+			}
+			else {
+				e.reads = ALL_GPRS;
+			}
+			break;
+		case 0x22:
+		case 0x26:
+			e.reads = rs | rt; e.writes = instr.rt;
+			break;
+		case 0x28:
+		case 0x29:
+		case 0x2a:
+		case 0x2b:
+		case 0x2e:
+			e.reads = rs | rt; e.exit = true;
+			break;
+		case 0x32:
+			e.reads = rs;
+			break;
+		case 0x3a:
+			e.reads = rs; e.exit = true;
+			break;
+		default:
+			if (PRIMARY_OPCODE(opcode) >= 0x08 && PRIMARY_OPCODE(opcode) <= 0x0e) {
+				e.reads = rs; e.writes = instr.rt; e.pure = true;
+			}
+			else if (PRIMARY_OPCODE(opcode) >= 0x20 && PRIMARY_OPCODE(opcode) <= 0x25) {
+				e.reads = rs; e.writes = instr.rt;
+			}
+			else {
+				e.reads = ALL_GPRS;
+			}
+			break;
+	}
+
+	if (instr.ends_block) {
+		e.exit = true;
+	}
+	return e;
+}
+
+//	result of a pure instruction whose inputs are all known, same semantics as its handler in cpu.cpp
+bool IR::fold(const Instruction& instr, const u32* values, u32& result) {
+	const u32 rs = values[instr.rs];
+	const u32 rt = values[instr.rt];
+	const u32 simm = (u32)SIGN_EXT32(instr.imm16);
+	const u32 zimm = (u16)instr.imm16;
+
+	switch (PRIMARY_OPCODE(instr.opcode)) {
+		case 0x00:
+			switch (SECONDARY_OPCODE(instr.opcode)) {
+				case 0x00: result = rt << instr.imm5; return true;
+				case 0x02: result = rt >> instr.imm5; return true;
+				case 0x03: result = (i32)rt >> instr.imm5; return true;
+				case 0x04: result = rt << (rs & 0x1f); return true;
+				case 0x06: result = rt >> (rs & 0x1f); return true;
+				case 0x07: result = (i32)rt >> (rs & 0x1f); return true;
+				case 0x20:
+				case 0x21: result = rt + rs; return true;
+				case 0x22:
+				case 0x23: result = rs - rt; return true;
+				case 0x24: result = rt & rs; return true;
+				case 0x25: result = rt | rs; return true;
+				case 0x26: result = rt ^ rs; return true;
+				case 0x27: result = ~(rt | rs); return true;
+				case 0x2a: result = ((i32)rt > (i32)rs) ? 1 : 0; return true;
+				case 0x2b: result = (rt > rs) ? 1 : 0; return true;
+			}
+			return false;
+		case 0x08:
+		case 0x09: result = rs + simm; return true;
+		case 0x0a: result = ((i32)rs < (i32)simm) ? 1 : 0; return true;
+		case 0x0b: result = (rs < simm) ? 1 : 0; return true;
+		case 0x0c: result = rs & zimm; return true;
+		case 0x0d: result = rs | zimm; return true;
+		case 0x0e: result = rs ^ zimm; return true;
+		case 0x0f: result = zimm << 16; return true;
+	}
+	return false;
+}
+
+//	register ops get a handler of their own, without the r[0] = 0 of the cpu.cpp ones
+bool IR::lowerALU(const Instruction& instr, Op& op) {
+	Handler handler = nullptr;
+	u32 value = 0;
+
+	switch (PRIMARY_OPCODE(instr.opcode)) {
+		case 0x00:
+			value = instr.imm5;
+			switch (SECONDARY_OPCODE(instr.opcode)) {
+				case 0x00: handler = [](const Op& o) { CPU::registers.r[o.rd] = CPU::registers.r[o.rt] << o.value; }; break;
+				case 0x02: handler = [](const Op& o) { CPU::registers.r[o.rd] = CPU::registers.r[o.rt] >> o.value; }; break;
+				case 0x03: handler = [](const Op& o) { CPU::registers.r[o.rd] = (i32)CPU::registers.r[o.rt] >> o.value; }; break;
+				case 0x04: handler = [](const Op& o) { CPU::registers.r[o.rd] = CPU::registers.r[o.rt] << (CPU::registers.r[o.rs] & 0x1f); }; break;
+				case 0x06: handler = [](const Op& o) { CPU::registers.r[o.rd] = CPU::registers.r[o.rt] >> (CPU::registers.r[o.rs] & 0x1f); }; break;
+				case 0x07: handler = [](const Op& o) { CPU::registers.r[o.rd] = (i32)CPU::registers.r[o.rt] >> (CPU::registers.r[o.rs] & 0x1f); }; break;
+				case 0x10: handler = [](const Op& o) { CPU::registers.r[o.rd] = CPU::registers.hi; }; break;
+				case 0x12: handler = [](const Op& o) { CPU::registers.r[o.rd] = CPU::registers.lo; }; break;
+				case 0x20:
+				case 0x21: handler = [](const Op& o) { CPU::registers.r[o.rd] = CPU::registers.r[o.rt] + CPU::registers.r[o.rs]; }; break;
+				case 0x22:
+				case 0x23: handler = [](const Op& o) { CPU::registers.r[o.rd] = CPU::registers.r[o.rs] - CPU::registers.r[o.rt]; }; break;
+				case 0x24: handler = [](const Op& o) { CPU::registers.r[o.rd] = CPU::registers.r[o.rt] & CPU::registers.r[o.rs]; }; break;
+				case 0x25: handler = [](const Op& o) { CPU::registers.r[o.rd] = CPU::registers.r[o.rt] | CPU::registers.r[o.rs]; }; break;
+				case 0x26: handler = [](const Op& o) { CPU::registers.r[o.rd] = CPU::registers.r[o.rt] ^ CPU::registers.r[o.rs]; }; break;
+				case 0x27: handler = [](const Op& o) { CPU::registers.r[o.rd] = ~(CPU::registers.r[o.rt] | CPU::registers.r[o.rs]); }; break;
+				case 0x2a: handler = [](const Op& o) { CPU::registers.r[o.rd] = ((i32)CPU::registers.r[o.rt] > (i32)CPU::registers.r[o.rs]) ? 1 : 0; }; break;
+				case 0x2b: handler = [](const Op& o) { CPU::registers.r[o.rd] = (CPU::registers.r[o.rt] > CPU::registers.r[o.rs]) ? 1 : 0; }; break;
+			}
+			op.rd = instr.rd;
+			break;
+		case 0x08:
+		case 0x09: handler = [](const Op& o) { CPU::registers.r[o.rd] = CPU::registers.r[o.rs] + o.value; }; value = (u32)SIGN_EXT32(instr.imm16); break;
+		case 0x0a: handler = [](const Op& o) { CPU::registers.r[o.rd] = ((i32)CPU::registers.r[o.rs] < (i32)o.value) ? 1 : 0; }; value = (u32)SIGN_EXT32(instr.imm16); break;
+		case 0x0b: handler = [](const Op& o) { CPU::registers.r[o.rd] = (CPU::registers.r[o.rs] < o.value) ? 1 : 0; }; value = (u32)SIGN_EXT32(instr.imm16); break;
+		case 0x0c: handler = [](const Op& o) { CPU::registers.r[o.rd] = CPU::registers.r[o.rs] & o.value; }; value = (u16)instr.imm16; break;
+		case 0x0d: handler = [](const Op& o) { CPU::registers.r[o.rd] = CPU::registers.r[o.rs] | o.value; }; value = (u16)instr.imm16; break;
+		case 0x0e: handler = [](const Op& o) { CPU::registers.r[o.rd] = CPU::registers.r[o.rs] ^ o.value; }; value = (u16)instr.imm16; break;
+	}
+
+	if (!handler) {
+		return false;
+	}
+	if (PRIMARY_OPCODE(instr.opcode) != 0x00) {
+		op.rd = instr.rt;
+	}
+	op.kind = Kind::ALU;
+	op.handler = handler;
+	op.value = value;
+	return true;
+}
+
+//	loads / stores with a known base, if the address ends up in main RAM or the scratchpad
+bool IR::lowerMemory(const Instruction& instr, u32 base, Op& op) {
+	const word effective = base + (u32)SIGN_EXT32(instr.imm16);
+	const bool scratchpad = SCRATCHPAD_ACCESS(effective);
+	const word address = MASKED_ADDRESS(effective);
+	if (!scratchpad && (address >= IR_RAM_END || Debugger::isWatchedPage(BLOCK_CACHE_PAGE(address)))) {
+		return false;
+	}
+
+	switch (PRIMARY_OPCODE(instr.opcode)) {
+		case 0x20: op.handler = scratchpad ? loadScratchpadHandler<byte, true> : loadRAMHandler<byte, true>; op.size = 1; break;
+		case 0x21: op.handler = scratchpad ? loadScratchpadHandler<hword, true> : loadRAMHandler<hword, true>; op.size = 2; break;
+		case 0x23: op.handler = scratchpad ? loadScratchpadHandler<word, false> : loadRAMHandler<word, false>; op.size = 4; break;
+		case 0x24: op.handler = scratchpad ? loadScratchpadHandler<byte, false> : loadRAMHandler<byte, false>; op.size = 1; break;
+		case 0x25: op.handler = scratchpad ? loadScratchpadHandler<hword, false> : loadRAMHandler<hword, false>; op.size = 2; break;
+		case 0x28: op.handler = scratchpad ? storeScratchpadHandler<byte> : storeRAMHandler<byte>; op.size = 1; break;
+		case 0x29: op.handler = scratchpad ? storeScratchpadHandler<hword> : storeRAMHandler<hword>; op.size = 2; break;
+		case 0x2b: op.handler = scratchpad ? storeScratchpadHandler<word> : storeRAMHandler<word>; op.size = 4; break;
+		default:
+			return false;
+	}
+
+	if (PRIMARY_OPCODE(instr.opcode) >= 0x28) {
+		op.kind = scratchpad ? Kind::StoreScratchpad : Kind::StoreRAM;
+	}
+	else {
+		op.kind = scratchpad ? Kind::LoadScratchpad : Kind::LoadRAM;
+	}
+	op.rd = instr.rt;
+	op.value = address;
+	return true;
+}
+
+/*
+	Pairs the cached interpreter runs as one op. The first op of a block is left alone, it may be
+	the delay slot of the block before, then the second half must not run at all.
+*/
+void IR::fuse(std::vector<Op>& ops) {
+	for (size_t i = 1; i + 1 < ops.size(); i++) {
+		Op& op = ops[i];
+		Op& next = ops[i + 1];
+		if (next.resync || next.delaySlot) {
+			continue;
+		}
+
+		const u8 primary = PRIMARY_OPCODE(op.instr->opcode);
+		const u8 nextPrimary = PRIMARY_OPCODE(next.instr->opcode);
+		Handler handler = nullptr;
+		u32 nextValue = next.value;
+
+		if (op.kind == Kind::Const && next.kind == Kind::Const) {
+			handler = fusedConstConst;
+		}
+		else if (op.kind == Kind::Const && next.kind == Kind::Guest && next.rs == op.rd && next.rt != 0) {
+			switch (nextPrimary) {
+				case 0x20: handler = fusedConstLoad<byte, true>; break;
+				case 0x21: handler = fusedConstLoad<hword, true>; break;
+				case 0x23: handler = fusedConstLoad<word, false>; break;
+				case 0x24: handler = fusedConstLoad<byte, false>; break;
+				case 0x25: handler = fusedConstLoad<hword, false>; break;
+			}
+			nextValue = op.value + (u32)SIGN_EXT32(next.instr->imm16);
+		}
+		else if (op.kind == Kind::ALU && next.kind == Kind::Guest && (nextPrimary == 0x04 || nextPrimary == 0x05) &&
+			((next.rs == op.rd && next.rt == 0) || (next.rs == 0 && next.rt == op.rd))) {
+			const bool branchIfSet = nextPrimary == 0x05;
+			if (primary == 0x00 && SECONDARY_OPCODE(op.instr->opcode) == 0x2a) {
+				handler = compareBranchHandler<0x2a>(branchIfSet);
+			}
+			else if (primary == 0x00 && SECONDARY_OPCODE(op.instr->opcode) == 0x2b) {
+				handler = compareBranchHandler<0x2b>(branchIfSet);
+			}
+			else if (primary == 0x0a || primary == 0x0b) {
+				handler = (primary == 0x0a) ? compareBranchHandler<0x0a>(branchIfSet) : compareBranchHandler<0x0b>(branchIfSet);
+			}
+			nextValue = next.address + 4 + ((u32)SIGN_EXT32(next.instr->imm16) << 2);
+		}
+		else if (op.kind == Kind::ALU && (primary == 0x08 || primary == 0x09) && op.rd == 29 && op.rs == 29 &&
+			next.kind == Kind::Guest && nextPrimary == 0x2b && next.rs == 29) {
+			handler = fusedStackStore;
+			nextValue = (u32)SIGN_EXT32(next.instr->imm16);
+		}
+
+		if (handler) {
+			op.handler = handler;
+			op.fused = true;
+			next.value = nextValue;
+			i++;
+		}
+	}
+}
+
+void IR::build(BlockCache::Block* block) {
+	const std::vector<Instruction>& instructions = block->instructions;
+	const size_t count = instructions.size();
+	std::vector<Op> ops(count);
+	std::vector<Effects> fx(count);
+
+	//	forward: constant propagation and lowering
+	u32 known = GPR_BIT(0);
+	u32 values[32] = { 0 };
+	for (size_t i = 0; i < count; i++) {
+		const Instruction& instr = instructions[i];
+		Op& op = ops[i];
+		Effects& e = fx[i];
+
+		op.handler = guestHandler;
+		op.kind = Kind::Guest;
+		op.rd = instr.rd;
+		op.rs = instr.rs;
+		op.rt = instr.rt;
+		op.size = 0;
+		op.delaySlot = i > 0 && instructions[i - 1].has_delay_slot;
+		op.resync = false;
+		op.fused = false;
+		op.cycles = instr.cycles;
+		op.address = block->address + 4 * (word)i;
+		op.value = 0;
+		op.instr = &instr;
+
+		e = effects(instr);
+		if (!optimize) {
+			continue;
+		}
+
+		u32 result;
+		if (e.pure && e.writes && (e.reads & ~known) == 0 && fold(instr, values, result)) {
+			op.kind = Kind::Const;
+			op.handler = constHandler;
+			op.rd = e.writes;
+			op.value = result;
+			e.reads = 0;
+			known |= GPR_BIT(e.writes);
+			values[e.writes] = result;
+			continue;
+		}
+
+		if ((known & GPR_BIT(instr.rs)) && lowerMemory(instr, values[instr.rs], op)) {
+			if (op.kind == Kind::LoadRAM || op.kind == Kind::LoadScratchpad) {
+				e.reads = 0;
+				e.pure = true;
+			}
+			else {
+				e.reads = GPR_BIT(instr.rt);
+			}
+		}
+		else if (e.pure) {
+			lowerALU(instr, op);
+		}
+
+		if (e.writes) {
+			known &= ~GPR_BIT(e.writes);
+		}
+	}
+
+	//	backward: dead write elimination, everything is live at the end of the block and where it may be left
+	std::vector<bool> keep(count, true);
+	u32 live = ALL_GPRS;
+	for (size_t i = count; i-- > 0;) {
+		const Effects& e = fx[i];
+		if (e.exit) {
+			live = ALL_GPRS;
+		}
+		if (optimize && e.pure && (e.writes == 0 || !(live & GPR_BIT(e.writes)))) {
+			if (i == 0 || i == count - 1) {
+				ops[i].kind = Kind::Nop;
+				ops[i].handler = nopHandler;
+			}
+			else {
+				keep[i] = false;
+			}
+			continue;
+		}
+		if (e.writes) {
+			live &= ~GPR_BIT(e.writes);
+		}
+		live |= e.reads;
+	}
+
+	//	compact, dropped instructions hand their cycles to the next op
+	block->ir.clear();
+	block->ir.reserve(count);
+	u32 carried = 0;
+	bool dropped = false;
+	for (size_t i = 0; i < count; i++) {
+		if (!keep[i]) {
+			carried += instructions[i].cycles;
+			dropped = true;
+			continue;
+		}
+		Op op = ops[i];
+		op.resync = dropped;
+		op.cycles = (u8)(op.cycles + carried);
+		block->ir.push_back(op);
+		carried = 0;
+		dropped = false;
+	}
+
+	if (optimize) {
+		fuse(block->ir);
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+#ifndef IR_GUARD
+#define IR_GUARD
+#include "defs.h"
+#include "cpu.h"
+#include <vector>
+#define IR_RAM_END 0x20'0000		//	main RAM
+
+namespace BlockCache {
+	struct Block;
+}
+
+/*
+	Block IR, built by the BlockCache for every block and run by the cached interpreter and
+	the recompiler instead of the plain decoded instructions.
+	The passes, in order:
+	 - constant propagation: LUI / ORI / ADDIU / .. with known inputs become a single Const
+	 - direct memory access: loads / stores at known addresses in main RAM or the scratchpad skip
+	   Memory::fetch / store
+	 - dead write elimination: register writes overwritten before anything reads them are dropped,
+	   as are writes to r0, so the handlers here never have to clear r[0] again
+	 - superinstructions: common pairs (constant builds, LUI / LW, SLT / BNE, ADDIU sp / SW) get
+	   one handler for both. Only the cached interpreter fuses, the recompiler sees the single ops
+	A block can only be left early after a store (it may invalidate the block), so registers
+	are always exact there. The first and the last instruction are never dropped, they may run
+	in a delay slot the block doesn't know about / end in one.
+*/
+namespace IR {
+
+	enum class Kind : u8 {
+		Guest,		//	the decoded instruction's own handler
+		Nop,		//	nothing left to do, only kept for pc / delay slot handling
+		ALU,		//	register op, rd is never r0
+		Const,		//	r[rd] = value
+		LoadRAM,	//	r[rd] = RAM[value]
+		StoreRAM,	//	RAM[value] = r[rt]
+		LoadScratchpad,		//	r[rd] = scratchpad[value]
+		StoreScratchpad		//	scratchpad[value] = r[rt]
+	};
+
+	struct Op;
+	typedef void (*Handler)(const Op&);
+
+	struct Op {
+		Handler handler;
+		Kind kind;
+		u8 rd;
+		u8 rs;
+		u8 rt;
+		u8 size;						//	loads / stores
+		bool delaySlot;					//	follows a jump / branch of this block
+		bool resync;					//	instructions right before it were dropped, pc has to be set from address
+		bool fused;						//	superinstruction, the handler runs the op after it as well (cached interpreter only)
+		u8 cycles;						//	its own plus the ones of dropped instructions before it
+		word address;
+		u32 value;						//	constant / immediate / RAM address, for fused Guest ops their precomputed address / target
+		const R3000A::Instruction* instr;	//	the instruction it came from
+	};
+
+	extern bool optimize;		//	--no-ir-opt, also off while tracing (the trace wants every single instruction)
+
+	void build(BlockCache::Block* block);
+}
+
+#endif
@@ -0,0 +1,242 @@
+#include "lockstep.h"
+#include "cpu.h"
+#include "mmu.h"
+#include "gte.h"
+#include "trace.h"
+#include "blockcache.h"
+#include "recompiler.h"
+#include <vector>
+#include <algorithm>
+#include <string.h>
+#include "include/spdlog/spdlog.h"
+#include "include/spdlog/sinks/stdout_color_sinks.h"
+
+static auto console = spdlog::stdout_color_mt("Lockstep");
+
+namespace Lockstep {
+	bool enabled = false;
+	thread_local Pass pass = Pass::Off;
+
+	struct Access {
+		word address;
+		u32 value;
+		u8 size;
+		u32 previous;		//	writes only, what RAM held before (for the rollback)
+
+		bool operator==(const Access& other) const {
+			return address == other.address && value == other.value && size == other.size;
+		}
+	};
+
+	//	everything the CPU side owns
+	struct Snapshot {
+		u32 r[32];
+		u32 pc;
+		u32 next_pc;
+		u32 log_pc;
+		u32 hi;
+		u32 lo;
+		R3000A::COP cop0;
+		GTE::State gte;
+		u64 cycles;
+	};
+
+	thread_local std::vector<Access> candidateWrites;
+	thread_local std::vector<Access> referenceWrites;
+	thread_local std::vector<Access> deviceReads;
+	thread_local size_t replayed = 0;
+	thread_local bool replayMismatch = false;
+
+	Snapshot capture();
+	void restore(const Snapshot& snapshot);
+	void rollback();
+	u32 runCandidate();
+	void report(word pc, const Snapshot& candidate, const Snapshot& reference, u32 candidateUsed, u32 referenceUsed);
+}
+
+void Lockstep::recordWrite(word address, u32 value, u8 size, u32 previous) {
+	std::vector<Access>& writes = (pass == Pass::Candidate) ? candidateWrites : referenceWrites;
+	writes.push_back({ address, value, size, previous });
+}
+
+void Lockstep::recordRead(word address, u32 value, u8 size) {
+	deviceReads.push_back({ address, value, size, 0 });
+}
+
+//	hands the reference pass what the device answered in the candidate pass
+u32 Lockstep::replayRead(word address, u8 size) {
+	if (replayed >= deviceReads.size() || deviceReads[replayed].address != address || deviceReads[replayed].size != size) {
+		replayMismatch = true;
+		return 0;
+	}
+	return deviceReads[replayed++].value;
+}
+
+Lockstep::Snapshot Lockstep::capture() {
+	Snapshot snapshot;
+	memcpy(snapshot.r, R3000A::registers.r, sizeof(snapshot.r));
+	snapshot.pc = R3000A::registers.pc;
+	snapshot.next_pc = R3000A::registers.next_pc;
+	snapshot.log_pc = R3000A::registers.log_pc;
+	snapshot.hi = R3000A::registers.hi;
+	snapshot.lo = R3000A::registers.lo;
+	snapshot.cop0 = R3000A::cop[0];
+	snapshot.gte = GTE::saveState();
+	snapshot.cycles = R3000A::cycles;
+	return snapshot;
+}
+
+void Lockstep::restore(const Snapshot& snapshot) {
+	memcpy(R3000A::registers.r, snapshot.r, sizeof(snapshot.r));
+	R3000A::registers.pc = snapshot.pc;
+	R3000A::registers.next_pc = snapshot.next_pc;
+	R3000A::registers.log_pc = snapshot.log_pc;
+	R3000A::registers.hi = snapshot.hi;
+	R3000A::registers.lo = snapshot.lo;
+	const bool isolated = R3000A::cop[0].sr.flags.isolate_cache;
+	R3000A::cop[0] = snapshot.cop0;
+	if (R3000A::cop[0].sr.flags.isolate_cache != isolated) {
+		Memory::isolateCache(R3000A::cop[0].sr.flags.isolate_cache);
+	}
+	GTE::loadState(snapshot.gte);
+	R3000A::cycles = snapshot.cycles;
+}
+
+//	undo the RAM writes of the candidate pass, newest first
+void Lockstep::rollback() {
+	for (auto it = candidateWrites.rbegin(); it != candidateWrites.rend(); ++it) {
+		if (!LOCKSTEP_DEVICE(it->address)) {
+			const word address = it->address & ~(word)(it->size - 1);	//	stores ignore the low address bits
+			if (u8* target = Memory::hostAddress(MASKED_ADDRESS(address))) {
+				memcpy(target, &it->previous, it->size);
+				Memory::wrote(address, it->size);
+			}
+		}
+	}
+}
+
+u32 Lockstep::runCandidate() {
+	switch (R3000A::engine) {
+		case R3000A::Engine::Recompiler:
+			return Recompiler::executeBlock();
+		case R3000A::Engine::CachedInterpreter:
+			return R3000A::executeBlock();
+		default:
+			return R3000A::step();
+	}
+}
+
+//	returns the cycles used, like the engines do
+u32 Lockstep::executeBlock() {
+	candidateWrites.clear();
+	referenceWrites.clear();
+	deviceReads.clear();
+	replayed = 0;
+	replayMismatch = false;
+
+	const Snapshot before = capture();
+	const u64 skippedBefore = R3000A::idleLoopStats.skippedCycles;
+
+	pass = Pass::Candidate;
+	const u32 used = runCandidate();
+	pass = Pass::Off;
+	const Snapshot candidate = capture();
+
+	//	idle loop skipping only happens on the candidate side
+	const u32 candidateUsed = (u32)(candidate.cycles - before.cycles - (R3000A::idleLoopStats.skippedCycles - skippedBefore));
+
+	rollback();
+	restore(before);
+
+	//	the reference pass doesn't show up in the trace
+	const bool tracing = Trace::enabled;
+	Trace::enabled = false;
+	pass = Pass::Reference;
+	u32 referenceUsed = 0;
+	while (referenceUsed < candidateUsed) {
+		referenceUsed += R3000A::step();
+	}
+	pass = Pass::Off;
+	Trace::enabled = tracing;
+
+	Snapshot reference = capture();
+	reference.cycles = candidate.cycles;
+
+	const bool same = referenceUsed == candidateUsed &&
+		memcmp(candidate.r, reference.r, sizeof(candidate.r)) == 0 &&
+		candidate.pc == reference.pc && candidate.next_pc == reference.next_pc &&
+		candidate.hi == reference.hi && candidate.lo == reference.lo &&
+		memcmp(candidate.cop0.r, reference.cop0.r, sizeof(candidate.cop0.r)) == 0 &&
+		candidate.cop0.sr.raw == reference.cop0.sr.raw && candidate.cop0.cause.raw == reference.cop0.cause.raw &&
+		candidate.cop0.epc == reference.cop0.epc &&
+		memcmp(&candidate.gte, &reference.gte, sizeof(GTE::State)) == 0 &&
+		candidateWrites == referenceWrites &&
+		!replayMismatch && replayed == deviceReads.size();
+
+	if (!same) {
+		report(before.pc, candidate, reference, candidateUsed, referenceUsed);
+		exit(1);
+	}
+
+	//	continue from the candidate's timeline (including skipped idle cycles)
+	R3000A::cycles = candidate.cycles;
+	return used;
+}
+
+void Lockstep::report(word pc, const Snapshot& candidate, const Snapshot& reference, u32 candidateUsed, u32 referenceUsed) {
+	console->error("Divergence in the block at {0:08x} (cycle {1:d})", pc, reference.cycles);
+
+	auto diff = [](const char* name, u32 a, u32 b) {
+		if (a != b) {
+			console->error("  {0:<8s} candidate {1:08x}  reference {2:08x}", name, a, b);
+		}
+	};
+
+	diff("cycles", candidateUsed, referenceUsed);
+	for (int i = 0; i < 32; i++) {
+		diff(R3000A::REG_LUT[i], candidate.r[i], reference.r[i]);
+	}
+	diff("pc", candidate.pc, reference.pc);
+	diff("next_pc", candidate.next_pc, reference.next_pc);
+	diff("hi", candidate.hi, reference.hi);
+	diff("lo", candidate.lo, reference.lo);
+	diff("sr", candidate.cop0.sr.raw, reference.cop0.sr.raw);
+	diff("cause", candidate.cop0.cause.raw, reference.cop0.cause.raw);
+	diff("epc", candidate.cop0.epc, reference.cop0.epc);
+	for (int i = 0; i < 32; i++) {
+		if (candidate.cop0.r[i] != reference.cop0.r[i]) {
+			console->error("  cop0r{0:<3d} candidate {1:08x}  reference {2:08x}", i, candidate.cop0.r[i], reference.cop0.r[i]);
+		}
+	}
+	for (int i = 0; i < 32; i++) {
+		if (candidate.gte.data[i] != reference.gte.data[i]) {
+			console->error("  cop2r{0:<3d} candidate {1:08x}  reference {2:08x}", i, candidate.gte.data[i], reference.gte.data[i]);
+		}
+		if (candidate.gte.control[i] != reference.gte.control[i]) {
+			console->error("  cop2r{0:<3d} candidate {1:08x}  reference {2:08x}", i + 32, candidate.gte.control[i], reference.gte.control[i]);
+		}
+	}
+	diff("gteflag", candidate.gte.flag, reference.gte.flag);
+
+	//	write streams, up to the first difference
+	const size_t count = std::max(candidateWrites.size(), referenceWrites.size());
+	for (size_t i = 0; i < count; i++) {
+		const bool hasCandidate = i < candidateWrites.size();
+		const bool hasReference = i < referenceWrites.size();
+		if (hasCandidate && hasReference && candidateWrites[i] == referenceWrites[i]) {
+			continue;
+		}
+		console->error("  write #{0:d}", i);
+		if (hasCandidate) {
+			console->error("    candidate [{0:08x}] = {1:08x} ({2:d} bytes)", candidateWrites[i].address, candidateWrites[i].value, candidateWrites[i].size);
+		}
+		if (hasReference) {
+			console->error("    reference [{0:08x}] = {1:08x} ({2:d} bytes)", referenceWrites[i].address, referenceWrites[i].value, referenceWrites[i].size);
+		}
+		break;
+	}
+
+	if (replayMismatch || replayed != deviceReads.size()) {
+		console->error("  device reads differ, {0:d} of {1:d} replayed", replayed, deviceReads.size());
+	}
+}
@@ -0,0 +1,35 @@
+#pragma once
+#ifndef LOCKSTEP_GUARD
+#define LOCKSTEP_GUARD
+#include "defs.h"
+#define LOCKSTEP_DEVICE(a) (a >= 0x1f80'1000 && a < 0x1fa0'0000)	//	masked addresses of I/O ports and Expansion Region 2
+
+/*
+	Lockstep differential runner, enabled with --lockstep.
+	Every block runs twice: first on the selected engine (the candidate), then the CPU state
+	and the RAM it wrote are rolled back and R3000A::step() runs the same stretch again as
+	reference. Device reads of the reference pass are replayed from the candidate pass and its
+	device writes are dropped, so the hardware only sees one of them.
+	Registers, COP0, the GTE, the cycles used and the memory write streams of both passes
+	have to match, otherwise the run stops with a report of the first divergence.
+*/
+namespace Lockstep {
+
+	enum class Pass {
+		Off,
+		Candidate,
+		Reference
+	};
+
+	extern bool enabled;
+	extern thread_local Pass pass;
+
+	//	hooks for Memory::fetch / Memory::store while a pass is running
+	void recordWrite(word address, u32 value, u8 size, u32 previous);
+	void recordRead(word address, u32 value, u8 size);
+	u32 replayRead(word address, u8 size);
+
+	u32 executeBlock();
+}
+
+#endif
@@ -6,7 +6,13 @@
 #include "cpu.h"
 #include "spu.h"
 #include "fileimport.h"
+#include "io.h"
 #include <iostream>
+#include <algorithm>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 #include "include/spdlog/spdlog.h"
 #include "include/spdlog/sinks/stdout_color_sinks.h"
 #define MASKED_ADDRESS(a) (a & 0x1fff'ffff)
@@ -15,27 +21,360 @@
 #define CPU R3000A
 
 namespace Memory {
-	I_STAT_MASK I_STAT;
-	I_STAT_MASK I_MASK;
-	u8* memory = new u8[0x2000'0000];
+	thread_local I_STAT_MASK I_STAT;
+	thread_local I_STAT_MASK I_MASK;
+	thread_local u8* memory = nullptr;
+	thread_local const u8* fetchPages[FETCH_PAGE_COUNT] = { nullptr };
+	thread_local std::string* ttyOutput = nullptr;
+	thread_local const u8** readPages = nullptr;
+	thread_local u8** writePages = nullptr;
+	thread_local u8** normalPages = nullptr;
+	thread_local u8** writeMap = nullptr;
+	thread_local ICacheLine icache[ICACHE_LINES];
+	thread_local word cacheControl = 0;
+	thread_local u8* scratchpad = nullptr;
+	thread_local u8* scratchpadStores = nullptr;
+	thread_local u64 dirtyPages[BITMAP_WORDS(RAM_PAGE_COUNT)];
+	thread_local u8* window = nullptr;
+	thread_local int memoryFile = -1;		//	memory is a shared mapping of it, so the window can map it again
+
+	//	writePages while the cache is isolated, never written so every instance can share it
+	static u8* isolatedPages[MEMORY_PAGE_COUNT] = { nullptr };
+
+	//	scratchpadStores while the cache is isolated, what lands here is never read
+	thread_local u8 isolatedScratchpad[SCRATCHPAD_SIZE];
+
+	//	the segments the window maps, KSEG2 and the KUSEG mirrors stay on the slow path
+	static const word windowSegments[] = { 0x0000'0000, 0x8000'0000, 0xa000'0000 };
+
+	//	reads as zeroes until a BIOS is loaded
+	static const u8 noBIOS[BIOS_SIZE] = { 0 };
+	thread_local const u8* bios = noBIOS;
 	std::shared_ptr<spdlog::logger> memConsole = spdlog::stdout_color_mt("Memory");
+
+	void mapFetchPages(word start, word end);
+	void mapBIOSPages();
+	void mapPages();
+	u8* allocateMemory();
+	void freeMemory();
+
+	//	registers that are only kept to be read back
+	template <typename T>
+	void writeRegisterFile(word address, u32 data) {
+		storeToMemory<T>(address, (T)data);
+	}
 }
 
 void Memory::init() { 
 	memConsole->info("Memory init");
+
+	memory = allocateMemory();
+	scratchpad = &memory[SCRATCHPAD_OFFSET];
+	scratchpadStores = scratchpad;
+	memset(scratchpad + SCRATCHPAD_SIZE, 0xff, MEMORY_PAGE_SIZE - SCRATCHPAD_SIZE);	//	open bus for recompiled reads past it
+	memset(dirtyPages, 0xff, sizeof(dirtyPages));
+	mapFetchPages(0x0000'0000, RAM_MIRRORS_END);
+	readPages = new const u8*[MEMORY_PAGE_COUNT];
+	normalPages = new u8*[MEMORY_PAGE_COUNT];
+	writePages = normalPages;
+	writeMap = new u8*[MEMORY_PAGE_COUNT];
+	mapPages();
+	mapBIOSPages();
+	IO::init();
+}
+
+void Memory::shutdown() {
+	unmapWindow();
+	freeMemory();
+	scratchpad = nullptr;
+	scratchpadStores = nullptr;
+	delete[] readPages;
+	delete[] normalPages;
+	delete[] writeMap;
+	readPages = nullptr;
+	writePages = nullptr;
+	normalPages = nullptr;
+	writeMap = nullptr;
+	memset(fetchPages, 0, sizeof(fetchPages));
+	bios = noBIOS;
+}
+
+//	a file in memory on Linux, so the fastmem window can map the same pages again
+u8* Memory::allocateMemory() {
+#ifdef __linux__
+	memoryFile = memfd_create("psx-memory", MFD_CLOEXEC);
+	if (memoryFile >= 0 && ftruncate(memoryFile, MEMORY_SIZE) == 0) {
+		void* mapping = mmap(nullptr, MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, memoryFile, 0);
+		if (mapping != MAP_FAILED) {
+			return (u8*)mapping;
+		}
+	}
+	if (memoryFile >= 0) {
+		close(memoryFile);
+		memoryFile = -1;
+	}
+#endif
+	return new u8[MEMORY_SIZE]();
+}
+
+void Memory::freeMemory() {
+#ifdef __linux__
+	if (memoryFile >= 0) {
+		munmap(memory, MEMORY_SIZE);
+		close(memoryFile);
+		memoryFile = -1;
+		memory = nullptr;
+		return;
+	}
+#endif
+	delete[] memory;
+	memory = nullptr;
+}
+
+//	false if the host can't have one, the recompiler then keeps its range checks
+bool Memory::mapWindow() {
+#ifdef __linux__
+	if (window) {
+		return true;
+	}
+	if (memoryFile < 0) {
+		return false;
+	}
+
+	void* reserved = mmap(nullptr, MEMORY_WINDOW_SIZE, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (reserved == MAP_FAILED) {
+		return false;
+	}
+	window = (u8*)reserved;
+	auto map = [](word address, size_t offset, size_t size) {
+		return mmap(window + address, size, PROT_NONE, MAP_SHARED | MAP_FIXED, memoryFile, offset) != MAP_FAILED;
+	};
+	for (word segment : windowSegments) {
+		bool mapped = map(segment + SCRATCHPAD_START, SCRATCHPAD_OFFSET, MEMORY_PAGE_SIZE);
+		for (word mirror = 0; mirror < RAM_MIRRORS_END; mirror += RAM_SIZE) {
+			mapped = mapped && map(segment + mirror, 0, RAM_SIZE);
+		}
+		if (!mapped) {
+			unmapWindow();
+			return false;
+		}
+	}
+	syncWindow(0, MEMORY_PAGE_COUNT);
+	return true;
+#else
+	return false;
+#endif
+}
+
+void Memory::unmapWindow() {
+#ifdef __linux__
+	if (window) {
+		munmap(window, MEMORY_WINDOW_SIZE);
+		window = nullptr;
+	}
+#endif
+}
+
+//	one mprotect per run of pages with the same rights and segment
+void Memory::syncWindow(u32 first, u32 count) {
+#ifdef __linux__
+	const bool isolated = CPU::cop[0].sr.flags.isolate_cache;
+	auto access = [isolated](u32 page) {
+		if (page == (SCRATCHPAD_START >> MEMORY_PAGE_SHIFT)) {
+			return isolated ? PROT_READ : PROT_READ | PROT_WRITE;
+		}
+
+		//	only pages that read straight from memory (RAM), not the BIOS image
+		if (readPages[page] < memory || readPages[page] >= memory + MEMORY_SIZE) {
+			return PROT_NONE;
+		}
+		return writePages[page] ? PROT_READ | PROT_WRITE : PROT_READ;
+	};
+
+	const u32 end = first + count;
+	for (u32 page = first; page < end;) {
+		const int rights = access(page);
+		u32 next = page + 1;
+		while (next < end && access(next) == rights) {
+			next++;
+		}
+		for (word segment : windowSegments) {
+			mprotect(window + segment + ((size_t)page << MEMORY_PAGE_SHIFT), (size_t)(next - page) << MEMORY_PAGE_SHIFT, rights);
+		}
+		page = next;
+	}
+
+	//	KSEG1 can't reach the scratchpad
+	if (first <= (SCRATCHPAD_START >> MEMORY_PAGE_SHIFT) && (SCRATCHPAD_START >> MEMORY_PAGE_SHIFT) < end) {
+		mprotect(window + 0xa000'0000 + SCRATCHPAD_START, MEMORY_PAGE_SIZE, PROT_NONE);
+	}
+#endif
+}
+
+void Memory::isolateCache(bool isolated) {
+	writePages = isolated ? isolatedPages : normalPages;
+	scratchpadStores = isolated ? isolatedScratchpad : scratchpad;
+	if (window) {
+		syncWindow(0, MEMORY_PAGE_COUNT);
+	}
 }
 
-void Memory::loadToRAM(word targetAddress, byte* source, word offset, word size) {
-	memcpy(&memory[MASKED_ADDRESS(targetAddress)], &source[offset], sizeof(byte) * size);
+void Memory::watchPage(u32 page) {
+	forEachMirror(page, [](u32 mirror) {
+		readPages[mirror] = nullptr;
+		writeMap[mirror] = nullptr;
+		normalPages[mirror] = nullptr;
+		if (window) {
+			syncWindow(mirror, 1);
+		}
+	});
+}
+
+void Memory::mapFetchPages(word start, word end) {
+	for (word address = start; address < end; address += FETCH_PAGE_SIZE) {
+		fetchPages[address >> FETCH_PAGE_SHIFT] = hostAddress(address);
+	}
+}
+
+void Memory::loadToRAM(word targetAddress, const byte* source, word offset, word size) {
+	const word address = MASKED_ADDRESS(targetAddress) & (RAM_SIZE - 1);
+	if (size > RAM_SIZE - address) {
+		memConsole->error("{0:x} bytes at {1:x} don't fit into RAM", size, targetAddress);
+		exit(1);
+	}
+	writeBlock(address, &source[offset], size);
 	memConsole->info("Done loading to RAM");
 }
 
-void Memory::loadBIOS(byte* source, word size) {
-	memcpy(&Memory::memory[0x1fc0'0000], &source[0x0000], sizeof(byte) * size);
+void Memory::readBlock(word address, void* destination, word size) {
+	u8* out = (u8*)destination;
+	while (size > 0) {
+		const word chunk = std::min<word>(size, MEMORY_PAGE_SIZE - (address & (MEMORY_PAGE_SIZE - 1)));
+		if (const u8* source = hostAddress(MASKED_ADDRESS(address))) {
+			memcpy(out, source, chunk);
+		}
+		else {
+			memset(out, 0xff, chunk);
+		}
+		address += chunk;
+		out += chunk;
+		size -= chunk;
+	}
+}
+
+void Memory::writeBlock(word address, const void* source, word size) {
+	const u8* in = (const u8*)source;
+	while (size > 0) {
+		const word chunk = std::min<word>(size, MEMORY_PAGE_SIZE - (address & (MEMORY_PAGE_SIZE - 1)));
+		if (u8* target = hostAddress(MASKED_ADDRESS(address))) {
+			memcpy(target, in, chunk);
+			wrote(address, chunk);
+		}
+		address += chunk;
+		in += chunk;
+		size -= chunk;
+	}
+}
+
+void Memory::wrote(word address, word size) {
+	if (size == 0) {
+		return;
+	}
+	BlockCache::invalidateRange(address, size);
+	for (u32 page = BLOCK_CACHE_PAGE(address); page <= BLOCK_CACHE_PAGE(address + size - 1) && page < RAM_PAGE_COUNT; page++) {
+		if (!isDirtyPage(page)) {
+			markDirtyPage(page);
+		}
+	}
+}
+
+void Memory::markDirtyPage(u32 page) {
+	BITMAP_SET(dirtyPages, page);
+	updatePage(page);
+}
+
+void Memory::clearDirtyPage(u32 page) {
+	BITMAP_CLEAR(dirtyPages, page);
+	updatePage(page);
+}
+
+//	all of RAM in one go, clean pages are write protected whether they have code or not
+void Memory::clearDirtyPages() {
+	memset(dirtyPages, 0, sizeof(dirtyPages));
+	for (u32 page = 0; page < (RAM_MIRRORS_END >> MEMORY_PAGE_SHIFT); page++) {
+		normalPages[page] = nullptr;
+	}
+	if (window) {
+		syncWindow(0, RAM_MIRRORS_END >> MEMORY_PAGE_SHIFT);
+	}
+}
+
+//	image has to stay alive (and unchanged) as long as any instance uses it
+void Memory::loadBIOS(const u8* image) {
+	bios = image;
+	mapBIOSPages();
 	memConsole->info("Done loading BIOS");
 }
 
+void Memory::mapBIOSPages() {
+	for (word offset = 0; offset < BIOS_SIZE; offset += FETCH_PAGE_SIZE) {
+		fetchPages[(BIOS_START + offset) >> FETCH_PAGE_SHIFT] = &bios[offset];
+	}
+
+	//	the BIOS can be loaded before init
+	if (readPages) {
+		for (word offset = 0; offset < BIOS_SIZE; offset += MEMORY_PAGE_SIZE) {
+			const u32 page = (BIOS_START + offset) >> MEMORY_PAGE_SHIFT;
+			readPages[page] = Debugger::isWatchedPage(page) ? nullptr : &bios[offset];
+		}
+	}
+}
+
+//	RAM is plain memory, the I/O register file needs the ladder and everything else is open bus.
+//	The scratchpad has a path of its own in fetch / store, the rest of its page is open bus as well.
+//	Watched pages take the ladder, so the debugger sees them
+void Memory::mapPages() {
+	for (u32 page = 0; page < MEMORY_PAGE_COUNT; page++) {
+		const word address = page << MEMORY_PAGE_SHIFT;
+		const bool io = address >= IO_START && address < IO_START + IO_SIZE;
+		const bool watched = Debugger::isWatchedPage(BLOCK_CACHE_PAGE(address));
+		u8* host = (io || watched || address == SCRATCHPAD_START) ? nullptr : hostAddress(address);
+		readPages[page] = host;
+		writeMap[page] = host;
+		normalPages[page] = host;
+	}
+}
+
+
+void Memory::mapIO() {
+	IO::mapRead(0x1f80'1070, [](word) -> u32 {
+		memConsole->debug("Reading from I_STAT");
+		return I_STAT.raw;
+	});
+	IO::mapRead(0x1f80'1074, [](word) -> u32 {
+		memConsole->debug("Reading from I_MASK");
+		return I_MASK.raw;
+	});
+	IO::mapWrite(0x1f80'1070, [](word, u32 data) {
+		I_STAT.raw = data;
+		memConsole->info("Writing to I_STAT (${0:x})", data);
+	});
+	IO::mapWrite(0x1f80'1074, [](word, u32 data) {
+		I_MASK.raw = data;
+		memConsole->info("Writing to I_MASK (${0:x})", data);
+	});
+
+	//	Memory Control 1
+	IO::mapWriteRange(0x1f80'1000, 0x1f80'1021, &writeRegisterFile<u8>, IO::Byte);
+	IO::mapWriteRange(0x1f80'1000, 0x1f80'1021, &writeRegisterFile<u16>, IO::Half);
+	IO::mapWriteRange(0x1f80'1000, 0x1f80'1021, &writeRegisterFile<u32>, IO::Word);
+
+	//	Memory Control 2
+	IO::mapWrite(0x1f80'1060, &writeRegisterFile<u8>, IO::Byte);
+	IO::mapWrite(0x1f80'1060, &writeRegisterFile<u16>, IO::Half);
+	IO::mapWrite(0x1f80'1060, &writeRegisterFile<u32>, IO::Word);
+}
 
 void Memory::dumpRAM() {
-	FileImport::saveFile("ramDump", memory, 0x200'000);
+	FileImport::saveFile("ramDump", memory, RAM_SIZE);
 }
@@ -7,286 +7,46 @@
 #include "spu.h"
 #include "dma.h"
 #include "timer.h"
+#include "blockcache.h"
+#include "lockstep.h"
+#include "io.h"
+#include "debugger.h"
+#include <string.h>
+#include <string>
 #include "include/spdlog/spdlog.h"
 #include "include/spdlog/sinks/stdout_color_sinks.h"
 #define MASKED_ADDRESS(a) (a & 0x1fff'ffff)
-#define SHOW_BIOS_FUNCTIONS false
+#define FETCH_PAGE_SHIFT 16
+#define FETCH_PAGE_SIZE (1 << FETCH_PAGE_SHIFT)
+#define FETCH_PAGE_COUNT (0x2000'0000 >> FETCH_PAGE_SHIFT)
+#define MEMORY_PAGE_SHIFT 12
+#define MEMORY_PAGE_SIZE (1 << MEMORY_PAGE_SHIFT)
+#define MEMORY_PAGE_COUNT (0x2000'0000 >> MEMORY_PAGE_SHIFT)
+#define BIOS_START 0x1fc0'0000
+#define BIOS_SIZE 0x8'0000
+#define RAM_SIZE 0x20'0000
+#define RAM_MIRRORS_END 0x80'0000		//	the 2 MiB of RAM show up 4 times
+#define RAM_PAGE_COUNT (RAM_SIZE >> MEMORY_PAGE_SHIFT)
+#define SCRATCHPAD_START 0x1f80'0000
+#define SCRATCHPAD_SIZE 0x400
+#define SCRATCHPAD_ACCESS(a) (((a) & 0x7fff'fc00) == SCRATCHPAD_START)	//	KUSEG / KSEG0 only, KSEG1 can't reach it
+#define SCRATCHPAD_OFFSET RAM_SIZE						//	offsets in memory, the scratchpad and the I/O ports get a page each
+#define IO_OFFSET (RAM_SIZE + MEMORY_PAGE_SIZE)
+#define MEMORY_SIZE (RAM_SIZE + 2 * MEMORY_PAGE_SIZE)
+#define CACHE_CONTROL MASKED_ADDRESS(0xfffe'0130)
+#define CACHE_CONTROL_TAG_TEST (1 << 2)
+#define ICACHE_LINE_SIZE 16
+#define ICACHE_LINES 256
+#define MEMORY_WINDOW_SIZE 0x1'0000'0000ull
+#define OPEN_BUS 0xffff'ffff		//	reads of addresses without anything behind them
+
+//	guest memory is read / written in host byte order, so the host has to be little endian like the R3000A
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "q00.psx needs a little endian host"
+#endif
 
 namespace Memory {
 
-	static const char* A_FUNC_LUT[] = {
-	"open(filename,accessmode)",
-	"lseek(fd,offset,seektype)",
-	"read(fd,dst,length)",
-	"write(fd,src,length)",
-	"close(fd)",
-	"ioctl(fd,cmd,arg)",
-	"exit(exitcode)",
-	"isatty(fd)",
-	"getc(fd)",
-	"putc(char,fd)",
-	"todigit(char)",
-	"atof(src)     ;Does NOT work - uses (ABSENT) cop1 !!!",
-	"strtoul(src,src_end,base)",
-	"strtol(src,src_end,base)",
-	"abs(val)",
-	"labs(val)",
-	"atoi(src)",
-	"atol(src)",
-	"atob(src,num_dst)",
-	"setjmp(buf)",
-	"longjmp(buf,param)",
-	"strcat(dst,src)",
-	"strncat(dst,src,maxlen)",
-	"strcmp(str1,str2)",
-	"strncmp(str1,str2,maxlen)",
-	"strcpy(dst,src)",
-	"strncpy(dst,src,maxlen)",
-	"strlen(src)",
-	"index(src,char)",
-	"rindex(src,char)",
-	"strchr(src,char)  ;exactly the same as 'index'",
-	"strrchr(src,char) ;exactly the same as 'rindex'",
-	"strpbrk(src,list)",
-	"strspn(src,list)",
-	"strcspn(src,list)",
-	"strtok(src,list)  ;use strtok(0,list) in further calls",
-	"strstr(str,substr)       ;Bugged",
-	"toupper(char)",
-	"tolower(char)",
-	"bcopy(src,dst,len)",
-	"bzero(dst,len)",
-	"bcmp(ptr1,ptr2,len)      ;Bugged",
-	"memcpy(dst,src,len)",
-	"memset(dst,fillbyte,len)",
-	"memmove(dst,src,len)     ;Bugged",
-	"memcmp(src1,src2,len)    ;Bugged",
-	"memchr(src,scanbyte,len)",
-	"rand()",
-	"srand(seed)",
-	"qsort(base,nel,width,callback)",
-	"strtod(src,src_end) ;Does NOT work - uses (ABSENT) cop1 !!!",
-	"malloc(size)",
-	"free(buf)",
-	"lsearch(key,base,nel,width,callback)",
-	"bsearch(key,base,nel,width,callback)",
-	"calloc(sizx,sizy)            ;SLOW!",
-	"realloc(old_buf,new_siz)     ;SLOW!",
-	"InitHeap(addr,size)",
-	"_exit(exitcode)",
-	"getchar()",
-	"putchar(char)",
-	"gets(dst)",
-	"puts(src)",
-	"printf(txt,param1,param2,etc.)",
-	"SystemErrorUnresolvedException()",
-	"LoadTest(filename,headerbuf)",
-	"Load(filename,headerbuf)",
-	"Exec(headerbuf,param1,param2)",
-	"FlushCache()",
-	"init_a0_b0_c0_vectors",
-	"GPU_dw(Xdst,Ydst,Xsiz,Ysiz,src)",
-	"gpu_send_dma(Xdst,Ydst,Xsiz,Ysiz,src)",
-	"SendGP1Command(gp1cmd)",
-	"GPU_cw(gp0cmd)   ;send GP0 command word",
-	"GPU_cwp(src,num) ;send GP0 command word and parameter words",
-	"send_gpu_linked_list(src)",
-	"gpu_abort_dma()",
-	"GetGPUStatus()",
-	"gpu_sync()",
-	"SystemError",
-	"SystemError",
-	"LoadExec(filename,stackbase,stackoffset)",
-	"GetSysSp",
-	"SystemError           ;PS2: set_ioabort_handler(src)",
-	"_96_init()",
-	"_bu_init()",
-	"_96_remove()  ;does NOT work due to SysDeqIntRP bug",
-	"return 0",
-	"return 0",
-	"return 0",
-	"return 0",
-	"dev_tty_init()                                      ;PS2: SystemError",
-	"dev_tty_open(fcb,and unused:'path/name',accessmode) ;PS2: SystemError",
-	"dev_tty_out(fcb,cmd)                             ;PS2: SystemError",
-	"dev_tty_ioctl(fcb,cmd,arg)                          ;PS2: SystemError",
-	"dev_cd_open(fcb,'path/name',accessmode)",
-	"dev_cd_read(fcb,dst,len)",
-	"dev_cd_close(fcb)",
-	"dev_cd_firstfile(fcb,'path/name',direntry)",
-	"dev_cd_nextfile(fcb,direntry)",
-	"dev_cd_chdir(fcb,'path')",
-	"dev_card_open(fcb,'path/name',accessmode)",
-	"dev_card_read(fcb,dst,len)",
-	"dev_card_write(fcb,src,len)",
-	"dev_card_close(fcb)",
-	"dev_card_firstfile(fcb,'path/name',direntry)",
-	"dev_card_nextfile(fcb,direntry)",
-	"dev_card_erase(fcb,'path/name')",
-	"dev_card_undelete(fcb,'path/name')",
-	"dev_card_format(fcb)",
-	"dev_card_rename(fcb1,'path/name1',fcb2,'path/name2')",
-	"?   ;card ;[r4+18h]=00000000h  ;card_clear_error(fcb) or so",
-	"_bu_init()",
-	"_96_init()",
-	"_96_remove()   ;does NOT work due to SysDeqIntRP bug",
-	"return 0",
-	"return 0",
-	"return 0",
-	"return 0",
-	"return 0",
-	"CdAsyncSeekL(src)",
-	"return 0               ;DTL-H: Unknown?",
-	"return 0               ;DTL-H: Unknown?",
-	"return 0               ;DTL-H: Unknown?",
-	"CdAsyncGetStatus(dst)",
-	"return 0               ;DTL-H: Unknown?",
-	"CdAsyncReadSector(count,dst,mode)",
-	"return 0               ;DTL-H: Unknown?",
-	"return 0               ;DTL-H: Unknown?",
-	"CdAsyncSetMode(mode)",
-	"return 0               ;DTL-H: Unknown?",
-	"return 0               ;DTL-H: Unknown?",
-	"return 0               ;DTL-H: Unknown?",
-	"return 0               ;DTL-H: Unknown?, or reportedly, CdStop (?)",
-	"return 0               ;DTL-H: Unknown?",
-	"return 0               ;DTL-H: Unknown?",
-	"return 0               ;DTL-H: Unknown?",
-	"return 0               ;DTL-H: Unknown?",
-	"return 0               ;DTL-H: Unknown?",
-	"return 0               ;DTL-H: Unknown?",
-	"return 0               ;DTL-H: Unknown?",
-	"return 0               ;DTL-H: Unknown?",
-	"return 0               ;DTL-H: Unknown?",
-	"return 0               ;DTL-H: Unknown?",
-	"CdromIoIrqFunc1()",
-	"CdromDmaIrqFunc1()",
-	"CdromIoIrqFunc2()",
-	"CdromDmaIrqFunc2()",
-	"CdromGetInt5errCode(dst1,dst2)",
-	"CdInitSubFunc()",
-	"AddCDROMDevice()",
-	"AddMemCardDevice()     ;DTL-H: SystemError",
-	"AddDuartTtyDevice()    ;DTL-H: AddAdconsTtyDevice ;PS2: SystemError",
-	"add_nullcon_driver()",
-	"SystemError            ;DTL-H: AddMessageWindowDevice",
-	"SystemError            ;DTL-H: AddCdromSimDevice",
-	"SetConf(num_EvCB,num_TCB,stacktop)",
-	"GetConf(num_EvCB_dst,num_TCB_dst,stacktop_dst)",
-	"SetCdromIrqAutoAbort(type,flag)",
-	"SetMem(megabytes)",
-	};
-	static const char* B_FUNC_LUT[] = {
-		"alloc_kernel_memory(size)",
-		"free_kernel_memory(buf)",
-		"init_timer(t,reload,flags)",
-		"get_timer(t)",
-		"enable_timer_irq(t)",
-		"disable_timer_irq(t)",
-		"restart_timer(t)",
-		"DeliverEvent(class, spec)",
-		"OpenEvent(class,spec,mode,func)",
-		"CloseEvent(event)",
-		"WaitEvent(event)",
-		"TestEvent(event)",
-		"EnableEvent(event)",
-		"DisableEvent(event)",
-		"OpenTh(reg_PC,reg_SP_FP,reg_GP)",
-		"CloseTh(handle)",
-		"ChangeTh(handle)",
-		"jump_to_00000000h",
-		"InitPAD2(buf1,siz1,buf2,siz2)",
-		"StartPAD2()",
-		"StopPAD2()",
-		"PAD_init2(type,button_dest,unused,unused)",
-		"PAD_dr()",
-		"ReturnFromException()",
-		"ResetEntryInt()",
-		"HookEntryInt(addr)",
-		"SystemError  ;PS2: return 0",
-		"SystemError  ;PS2: return 0",
-		"SystemError  ;PS2: return 0",
-		"SystemError  ;PS2: return 0",
-		"SystemError  ;PS2: return 0",
-		"SystemError  ;PS2: return 0",
-		"UnDeliverEvent(class,spec)",
-		"SystemError  ;PS2: return 0",
-		"SystemError  ;PS2: return 0",
-		"SystemError  ;PS2: return 0",
-		"jump_to_00000000h",
-		"jump_to_00000000h",
-		"jump_to_00000000h",
-		"jump_to_00000000h",
-		"jump_to_00000000h",
-		"jump_to_00000000h",
-		"SystemError  ;PS2: return 0",
-		"SystemError  ;PS2: return 0",
-		"jump_to_00000000h",
-		"jump_to_00000000h",
-		"jump_to_00000000h",
-		"jump_to_00000000h",
-		"jump_to_00000000h",
-		"jump_to_00000000h",
-		"open(filename,accessmode)",
-		"lseek(fd,offset,seektype)",
-		"read(fd,dst,length)",
-		"write(fd,src,length)",
-		"close(fd)",
-		"ioctl(fd,cmd,arg)",
-		"exit(exitcode)",
-		"isatty(fd)",
-		"getc(fd)",
-		"putc(char,fd)",
-		"getchar()",
-		"putchar(char)",
-		"gets(dst)",
-		"puts(src)",
-		"cd(name)",
-		"format(devicename)",
-		"firstfile2(filename,direntry)",
-		"nextfile(direntry)",
-		"rename(old_filename,new_filename)",
-		"erase(filename)",
-		"undelete(filename)",
-		"AddDrv(device_info)  ;subfunction for AddXxxDevice functions",
-		"DelDrv(device_name_lowercase)",
-		"PrintInstalledDevices()"
-	};
-	static const char* C_FUNC_LUT[] = {
-		"EnqueueTimerAndVblankIrqs(priority)",
-		"EnqueueSyscallHandler(priority)",
-		"EnqueueTimerAndVblankIrqs(priority) ;used with prio=1",
-		"EnqueueSyscallHandler(priority)     ;used with prio=0",
-		"SysEnqIntRP(priority,struc)  ;bugged, use with care",
-		"SysDeqIntRP(priority,struc)  ;bugged, use with care",
-		"get_free_EvCB_slot()",
-		"get_free_TCB_slot()",
-		"ExceptionHandler()",
-		"InstallExceptionHandlers()  ;destroys/uses k0/k1",
-		"SysInitMemory(addr,size)",
-		"SysInitKernelVariables()",
-		"ChangeClearRCnt(t,flag)",
-		"SystemError  ;PS2: return 0",
-		"InitDefInt(priority) ;used with prio=3",
-		"SetIrqAutoAck(irq,flag)",
-		"return 0               ;DTL-H2000: dev_sio_init",
-		"return 0               ;DTL-H2000: dev_sio_open",
-		"return 0               ;DTL-H2000: dev_sio_out",
-		"return 0               ;DTL-H2000: dev_sio_ioctl",
-		"InstallDevices(ttyflag)",
-		"FlushStdInOutPut()",
-		"return 0               ;DTL-H2000: SystemError",
-		"_cdevinput(circ,char)",
-		"_cdevscan()",
-		"_circgetc(circ)    ;uses r5 as garbage txt for _ioabort",
-		"_circputc(char,circ)",
-		"_ioabort(txt1,txt2)",
-		"set_card_find_mode(mode)  ;0=normal, 1=find deleted files",
-		"KernelRedirect(ttyflag)   ;PS2: ttyflag=1 causes SystemError",
-		"AdjustA0Table()",
-		"get_card_find_mode()"
-	};
-
 	union I_STAT_MASK {
 		struct {
 			u32 irq0_vblank : 1;
@@ -306,64 +66,231 @@ namespace Memory {
 	};
 	static_assert(sizeof(I_STAT_MASK) == sizeof(u32), "Union not at the expected size!");
 
-	extern I_STAT_MASK I_STAT;
-	extern I_STAT_MASK I_MASK;
-	extern u8* memory;
+	extern thread_local I_STAT_MASK I_STAT;
+	extern thread_local I_STAT_MASK I_MASK;
+	extern thread_local u8* memory;		//	RAM, the scratchpad and the I/O register file, see hostAddress
+	extern thread_local u8* scratchpad;	//	SCRATCHPAD_SIZE bytes of memory
+	extern thread_local u8* scratchpadStores;	//	scratchpad, or a throwaway copy while the cache is isolated
+	extern thread_local const u8* fetchPages[FETCH_PAGE_COUNT];
+	extern thread_local const u8* bios;			//	BIOS_SIZE bytes, shared by every instance that loaded the same image
+	extern thread_local std::string* ttyOutput;	//	putchar output goes here instead of stdout if set
 	extern std::shared_ptr<spdlog::logger> memConsole;
 
+	/*
+		Page table of fetch / store, 4 KiB pages of the masked address space.
+		A page maps to the host memory behind it, so the common access is one lookup plus a
+		load / store. Null pages take the region ladder of fetchSlow / storeSlow instead:
+		I/O ports and the expansion regions 2 / 3,
+		the BIOS and every page that has compiled code in it for writes (the blocks built
+		from it have to be thrown away).
+		Stores go through writePages, which is one of two tables: normalPages, or while the cache
+		is isolated (COP0 SR IsC) a table without a single page, so that every store takes
+		storeSlow and ends up in the I-cache. Only COP0 SR writes switch them (isolateCache),
+		the common store never looks at IsC.
+	*/
+	extern thread_local const u8** readPages;
+	extern thread_local u8** writePages;
+	extern thread_local u8** normalPages;
+	extern thread_local u8** writeMap;		//	normalPages without the code pages
+
+	/*
+		Fastmem window of the recompiler (Linux only), 4 GiB of address space where the host
+		address of a guest access is just window + address. KUSEG, KSEG0 and KSEG1 map the same
+		pages as memory, with the access rights of the page tables: null pages (I/O, ..) can't
+		be touched at all, code pages and all of it while the cache is isolated are read only.
+		The scratchpad page is the exception, it's there in KUSEG / KSEG0 only (as a whole,
+		the window can't do 1 KiB). Everything else in the window faults as well.
+	*/
+	extern thread_local u8* window;		//	null if not mapped
+
 	void init();
+	void shutdown();
+	bool mapWindow();
+	void unmapWindow();
+	void syncWindow(u32 first, u32 count);		//	page tables / cache isolation changed for these pages
+	void isolateCache(bool isolated);			//	COP0 SR IsC changed
+	void watchPage(u32 page);					//	takes it out of the page tables for good, see Debugger
+
+	//	a RAM page is there once per mirror
+	template<typename F>
+	inline void forEachMirror(u32 page, F f) {
+		if (page < RAM_PAGE_COUNT) {
+			for (u32 mirror = page; mirror < (RAM_MIRRORS_END >> MEMORY_PAGE_SHIFT); mirror += RAM_PAGE_COUNT) {
+				f(mirror);
+			}
+		}
+		else {
+			f(page);
+		}
+	}
+
+	/*
+		RAM pages written since their bit was last cleared (incremental save states, rewind),
+		one bit per 4 KiB page of RAM, the mirrors share it. Everything starts out dirty.
+		A clean page is write protected like a code page, so the first store to it takes the
+		slow path (or faults in recompiled code) and sets the bit, which lifts the protection
+		again. Stores through the page tables never look at it, storeToMemory (the slow path,
+		DMA) tests a single bit. Host side writes (writeBlock, HLE, ..) report them with wrote.
+	*/
+	extern thread_local u64 dirtyPages[BITMAP_WORDS(RAM_PAGE_COUNT)];
+
+	inline bool isDirtyPage(u32 page) {
+		return BITMAP_TEST(dirtyPages, page);
+	}
+	void markDirtyPage(u32 page);
+	void clearDirtyPage(u32 page);
+	void clearDirtyPages();
+	void wrote(word address, word size);		//	throws away code built from it and marks it dirty
+
+	//	a page is only written straight through the page tables if nobody has to see it: no code
+	//	built from it (called by the BlockCache when it gets its first block / loses its last one)
+	//	and for RAM dirty already
+	inline void updatePage(u32 page) {
+		const bool writable = !BlockCache::isCodePage(page) && (page >= RAM_PAGE_COUNT || isDirtyPage(page));
+		forEachMirror(page, [writable](u32 mirror) {
+			normalPages[mirror] = writable ? writeMap[mirror] : nullptr;
+			if (window) {
+				syncWindow(mirror, 1);
+			}
+		});
+	}
+	static_assert(MEMORY_PAGE_SIZE == BLOCK_CACHE_PAGE_SIZE, "code pages are protected one memory page at a time");
+
+	template<typename T>
+	inline T readPage(const u8* page, word address) {
+		T value;
+		memcpy(&value, page + (address & (MEMORY_PAGE_SIZE - sizeof(T))), sizeof(T));
+		return value;
+	}
+
+	template<typename T>
+	inline void writePage(u8* page, word address, T value) {
+		memcpy(page + (address & (MEMORY_PAGE_SIZE - sizeof(T))), &value, sizeof(T));
+	}
+
+	/*
+		Scratchpad (the D-cache used as 1 KiB of fast RAM), fetch / store check for it before
+		anything else. Its page has no page table entry, so KSEG1 and the rest of the page take
+		the slow path and read as open bus.
+	*/
+	template<typename T>
+	inline T readScratchpad(word address) {
+		T value;
+		memcpy(&value, scratchpad + (address & (SCRATCHPAD_SIZE - sizeof(T))), sizeof(T));
+		return value;
+	}
+
+	/*
+		I-cache, 256 lines of 16 bytes. Instruction fetch doesn't go through it, it's only
+		there for the stores made while the cache is isolated (the BIOS flushes it that way):
+		in tag test mode (cache control bit 2) they set the tag of the line and invalidate it,
+		otherwise they land in the line's data.
+	*/
+	struct ICacheLine {
+		word tag;
+		bool valid;
+		u8 data[ICACHE_LINE_SIZE];
+	};
+
+	extern thread_local ICacheLine icache[ICACHE_LINES];
+	extern thread_local word cacheControl;		//	FFFE0130h
+
+	template<typename T>
+	inline void storeICache(word address, T data) {
+		ICacheLine& line = icache[(address / ICACHE_LINE_SIZE) % ICACHE_LINES];
+		if (cacheControl & CACHE_CONTROL_TAG_TEST) {
+			line.tag = address & ~(word)(ICACHE_LINE_SIZE * ICACHE_LINES - 1);
+			line.valid = false;
+			return;
+		}
+		memcpy(&line.data[address & (ICACHE_LINE_SIZE - sizeof(T))], &data, sizeof(T));
+	}
+
+	//	lockstep has to see the write, an isolated cache drops it (isolateCache points scratchpadStores elsewhere)
+	template<typename T>
+	inline void storeScratchpad(word address, T data) {
+		if (Lockstep::pass != Lockstep::Pass::Off) {
+			Lockstep::recordWrite(MASKED_ADDRESS(address), data, sizeof(T), readScratchpad<T>(address));
+		}
+		memcpy(scratchpadStores + (address & (SCRATCHPAD_SIZE - sizeof(T))), &data, sizeof(T));
+	}
+
+	/*
+		Instruction fetch, bypasses the region ladder of fetch<T>.
+		Code can only run from RAM and the BIOS, those pages map to host memory in fetchPages.
+		Everything else (scratchpad, I/O, the empty Expansion Region 1, ..) is a null page and
+		the fetch fails, the CPU raises an Instruction Bus Error for it.
+	*/
+	inline bool fetchInstruction(word address, word& opcode) {
+		const u8* page = fetchPages[MASKED_ADDRESS(address) >> FETCH_PAGE_SHIFT];
+		if (!page) {
+			return false;
+		}
+		memcpy(&opcode, page + (address & (FETCH_PAGE_SIZE - 4)), sizeof(word));
+		return true;
+	}
 	
+	/*
+		Host memory behind a masked address, null if there is nothing (open bus).
+		Only RAM (with its mirrors), the scratchpad and the I/O register file (ports without
+		a device behind them read back what was written) have backing. The scratchpad owns
+		the 4 KiB page it is in, the fastmem window maps it as a whole.
+	*/
+	inline u8* hostAddress(word address) {
+		if (address < RAM_MIRRORS_END) {
+			return &memory[address & (RAM_SIZE - 1)];
+		}
+		if (address - SCRATCHPAD_START < SCRATCHPAD_SIZE) {
+			return &memory[SCRATCHPAD_OFFSET + (address - SCRATCHPAD_START)];
+		}
+		if (address - IO_START < IO_SIZE) {
+			return &memory[IO_OFFSET + (address - IO_START)];
+		}
+		return nullptr;
+	}
+
+	//	aligned, so a single host access that never leaves its region
 	template<typename T>
 	T readFromMemory(word address) {
-
-		//	byte / u8
-		if constexpr (sizeof(T) == sizeof(u8)) {
-			return memory[MASKED_ADDRESS(address)];
-		}
-		//	hword / u16
-		else if constexpr (sizeof(T) == sizeof(u16)) {
-			address &= 0xffff'fffe;
-			hword res = memory[MASKED_ADDRESS(address)];
-			res |= memory[MASKED_ADDRESS(address + 1)] << 8;
-			return res;
-		}
-		//	word / u32
-		else if constexpr (sizeof(T) == sizeof(u32)) {
-			address &= 0xffff'fffc;
-			word res = memory[MASKED_ADDRESS(address)];
-			res |= memory[MASKED_ADDRESS(address + 1)] << 8;
-			res |= memory[MASKED_ADDRESS(address + 2)] << 16;
-			res |= memory[MASKED_ADDRESS(address + 3)] << 24;
-			return res;
+		address &= ~(word)(sizeof(T) - 1);
+		const u8* source = hostAddress(MASKED_ADDRESS(address));
+		if (!source) {
+			return (T)OPEN_BUS;
 		}
+		T res;
+		memcpy(&res, source, sizeof(T));
+		return res;
 	}
 
+	//	the BIOS isn't part of memory, its image is shared
+	template<typename T>
+	T readFromBIOS(word address) {
+		address &= ~(word)(sizeof(T) - 1);
+		T res;
+		memcpy(&res, &bios[MASKED_ADDRESS(address) - BIOS_START], sizeof(T));
+		return res;
+	}
+
+	//	memory itself, the cache is none of its business (DMA writes through an isolated cache)
 	template<typename T>
 	void storeToMemory(word address, T data) {
+		address &= ~(word)(sizeof(T) - 1);
+		u8* target = hostAddress(MASKED_ADDRESS(address));
+		if (!target) {
+			return;
+		}
 
-		if (!R3000A::cop[0].sr.flags.isolate_cache) {
-			//	byte / u8
-			if constexpr (sizeof(T) == sizeof(u8)) {
-				memory[MASKED_ADDRESS(address)] = data;
-			}
-			//	hword / u16
-			else if constexpr (sizeof(T) == sizeof(u16)) {
-				address &= 0xffff'fffe;
-				memory[MASKED_ADDRESS(address)] = data & 0xff;
-				memory[MASKED_ADDRESS(address + 1)] = (data >> 8) & 0xff;
-			}
-			//	word / u32
-			else if constexpr (sizeof(T) == sizeof(u32)) {
-				address &= 0xffff'fffc;
-				memory[MASKED_ADDRESS(address)] = data & 0xff;
-				memory[MASKED_ADDRESS(address + 1)] = (data >> 8) & 0xff;
-				memory[MASKED_ADDRESS(address + 2)] = (data >> 16) & 0xff;
-				memory[MASKED_ADDRESS(address + 3)] = (data >> 24) & 0xff;
-			}
+		//	throw away compiled code built from this page
+		const u32 page = BLOCK_CACHE_PAGE(address);
+		if (BlockCache::isCodePage(page)) {
+			BlockCache::invalidatePage(page);
+		}
+		memcpy(target, &data, sizeof(T));
+		if (page < RAM_PAGE_COUNT && !isDirtyPage(page)) {
+			markDirtyPage(page);
 		}
 	}
 
-
 	/*
 		KUSEG     KSEG0     KSEG1
 		00000000h 80000000h A0000000h  2048K  Main RAM (first 64K reserved for BIOS)
@@ -378,216 +305,99 @@ namespace Memory {
 
 
 	template <typename T>
-	T fetch(word address) {
+	T fetchSlow(word address);
+	template <typename T>
+	void storeSlow(word address, T data);
+
+	template <typename T>
+	inline T fetch(word address) {
+		if (SCRATCHPAD_ACCESS(address)) {
+			return readScratchpad<T>(address);
+		}
+		address = MASKED_ADDRESS(address);
+		if (const u8* page = readPages[address >> MEMORY_PAGE_SHIFT]) {
+			return readPage<T>(page, address);
+		}
+		return fetchSlow<T>(address);
+	}
+
+	//	lockstep has to see every write
+	template <typename T>
+	inline void store(word address, T data) {
+		if (SCRATCHPAD_ACCESS(address)) {
+			storeScratchpad<T>(address, data);
+			return;
+		}
 		address = MASKED_ADDRESS(address);
+		u8* page = writePages[address >> MEMORY_PAGE_SHIFT];
+		if (page && Lockstep::pass == Lockstep::Pass::Off) {
+			writePage<T>(page, address, data);
+			return;
+		}
+		storeSlow<T>(address, data);
+	}
 
-		//	RAM
-		if (address < 0x1f00'0000) {
+	//	store to an address that is known to be in main RAM (block IR), skips the region ladder of store<T>.
+	//	Takes writePages like store<T>, so the cache isolation is left to storeSlow
+	template<typename T>
+	inline void storeRAM(word address, T data) {
+		address = MASKED_ADDRESS(address);
+		u8* page = writePages[address >> MEMORY_PAGE_SHIFT];
+		if (page && Lockstep::pass == Lockstep::Pass::Off) {
+			writePage<T>(page, address, data);
+			return;
+		}
+		storeSlow<T>(address, data);
+	}
 
-			//	Thunk function calls
-			byte thunkFunctionId = R3000A::registers.r[9];
-			if ((address == 0xa0 && thunkFunctionId == 0x3c) ||
-				(address == 0xb0 && thunkFunctionId == 0x3d)) {
-				printf("%c", R3000A::registers.r[4]);
-			}
-			else if (address == 0xa0 && SHOW_BIOS_FUNCTIONS) {
-				memConsole->info("A-Function ({0:x}) - {1:s}", thunkFunctionId, A_FUNC_LUT[thunkFunctionId]);
-			}
-			else if (address == 0xb0 && SHOW_BIOS_FUNCTIONS) {
-				memConsole->info("B-Function ({0:x}) - {1:s}", thunkFunctionId, B_FUNC_LUT[thunkFunctionId]);
-			}
-			else if (address == 0xc0 && SHOW_BIOS_FUNCTIONS) {
-				memConsole->info("C-Function ({0:x}) - {1:s}", thunkFunctionId, C_FUNC_LUT[thunkFunctionId]);
+	template <typename T>
+	T fetchSlow(word address) {
+
+		//	watched page: the access runs as usual, then the watchpoints see it
+		if (Debugger::watching && Debugger::isWatchedPage(BLOCK_CACHE_PAGE(address))) {
+			Debugger::watching = false;
+			const T value = fetchSlow<T>(address);
+			Debugger::watching = true;
+			Debugger::read(address, sizeof(T), value);
+			return value;
+		}
+
+		//	lockstep: devices only get read once, the reference pass sees the same values again
+		if (Lockstep::pass != Lockstep::Pass::Off && LOCKSTEP_DEVICE(address)) {
+			if (Lockstep::pass == Lockstep::Pass::Reference) {
+				return (T)Lockstep::replayRead(address, sizeof(T));
 			}
+			Lockstep::pass = Lockstep::Pass::Off;
+			const T value = fetch<T>(address);
+			Lockstep::pass = Lockstep::Pass::Candidate;
+			Lockstep::recordRead(address, value, sizeof(T));
+			return value;
+		}
 
+		//	RAM
+		if (address < 0x1f00'0000) {
 			return readFromMemory<T>(address);
 		}
 
 
-		//	Expansion Region 1
+		//	Expansion Region 1, nothing plugged in
 		else if (address < 0x1f80'0000) {
-			//memConsole->error("Reading from unknown address on Expansion Region 1 {0:x}", address);
-			//exit(1);
-			return readFromMemory<T>(address);
+			return (T)OPEN_BUS;
 		}
 
 
-		//	Scratchpad
+		//	Scratchpad through KSEG1 / past its 1 KiB
 		else if (address < 0x1f80'1000) {
-			memConsole->error("Reading from unknown address on Scratchpad {0:x}", address);
-			exit(1);
+			return (T)OPEN_BUS;
 		}
 
 
 		//	I/O Ports
-		else if (address < 0x1f80'2000) {
-
-			//	GPUREAD
-			if (address == 0x1f80'1810) {
-				return GPU::readGPUREAD();
-			}
-			
-			//	GPUSTAT
-			else if (address == 0x1f80'1814) {
-				return GPU::readGPUSTAT();
-			}
-			
-			//	I_STAT - Interrupt Status Register
-			else if (address == 0x1f80'1070) {
-				memConsole->debug("Reading from I_STAT");
-				return I_STAT.raw;
-			}
-			
-			//	I_MASK - Interrupt Mask Register
-			else if (address == 0x1f80'1074) {
-				memConsole->debug("Reading from I_MASK");
-				return I_MASK.raw;
-			}
-
-			//	DMA Registers
-			else if (address >= 0x1f80'1080 && address < 0x1f80'1100) {
-				u8 channel = (address % 0x1f80'1084) >> 4;
-
-				//	DMA control register
-				if (address == 0x1f80'10f0) {
-					return DMA::readDMAControlRegister();
-				}
-
-				//	DMA interrupt register
-				else if (address == 0x1f80'10f4) {
-					return DMA::readDMAInterruptRegister();
-				}
-					
-				//	DMA base address (for channel N)
-				else if ((address & 0b1111) == 0) {
-					if (channel == 1) {
-						spdlog::set_level(spdlog::level::debug);
-					}
-					return DMA::readDMABaseAddress(channel);
-				}
-
-				//	DMA block control
-				else if ((address & 0b1111) == 4) {
-					memConsole->error("Reading DMA (channel {0:x}) block control [${1:08x}]", channel, address);
-					exit(1);
-				}
-
-				//	DMA channel control
-				else if ((address & 0b1111) == 8) {
-					return DMA::readDMAChannelControl(channel);
-				}
-
-				else {
-					memConsole->error("Invalid DMA read at {0:x}", address);
-					exit(1);
-				}
-			}
-
-			//	SPU
-			else if (address >= 0x1f80'1c00 && address < 0x1f80'2000) {
-
-				//	Voice volume
-				if (address >= 0x1f80'1c00 && address <= 0x1f80'1d7f) {
-					u8 voice = (address % 0x01f801c00) >> 4;
-					if ((address & 0b1111) == 0) {
-						//SPU::writeVoiceVolumeLeft(data, voice);
-					}
-					else if ((address & 0b1111) == 2) {
-						//SPU::writeVoiceVolumeRight(data, voice);
-					}
-					else if ((address & 0b1111) == 4) {
-						//SPU::writeVoiceADPCMSampleRate(data, voice);
-					}
-					else if ((address & 0b1111) == 0xc) {
-						return SPU::readVoiceCurrentADSRVolume(voice);
-					}
-				}
-
-				//	SPUSTAT
-				else if (address == 0x1f80'1dae) {
-					return SPU::readSPUSTAT();
-				}
-
-				//	SPUCNT
-				else if (address == 0x1f80'1daa) {
-					return SPU::readSPUCNT();
-				}
-
-				//	Voice Key ON
-				else if (address == 0x1f80'1d88) {
-					return SPU::readVoiceKeyOn();
-				}
-				else if (address == 0x1f80'1d8a) {
-					return SPU::readVoiceKeyOn(true);
-				}
-
-				//	Voice Key OFF
-				else if (address == 0x1f80'1d8c) {
-					return SPU::readVoiceKeyOff();
-				}
-				else if (address == 0x1f80'1d8e) {
-					return SPU::readVoiceKeyOff(true);
-				}
-
-				//	Voice ON/OFF
-				else if (address == 0x1f80'1d9c) {
-					return SPU::readVoiceOnOff();
-				}
-
-				//	Sound RAM data transfer address
-				else if (address == 0x1f80'1da6) {
-					return SPU::readSoundRAMDataTransferAddress();
-				}
-
-				//	Sound RAM data transfer fifo
-				else if (address == 0x1f80'1da8) {
-					return SPU::readSoundRAMDataTransferFifo();
-				}
-
-				//	Sound RAM data transfer control
-				else if (address == 0x1f80'1dac) {
-					return SPU::readSoundRAMDataTransferControl();
-				}
-
-				else {
-					memConsole->error("SPU read detected at {0:x}", address);
-					//return 0xffffffff;
-					exit(1);
-				}
-			}
-
-			//	Timers
-			else if (address >= 0x1f80'1100 && address < 0x1f80'1128) {
-				u8 counter = (address % 0x1f80'1100) >> 4;
-
-				//	Current counter 
-				if ((address & 0b1111) == 0) {
-					return Timer::readCurrentCounter(counter);
-				}
-
-				//	Counter mode
-				else if ((address & 0b1111) == 4) {
-					return Timer::readCounterMode(counter);
-				}
-
-				//	Counter targer
-				else if ((address & 0b1111) == 8) {
-					return Timer::readCounterTarget(counter);
-				}
-
-				//	Unhandled reads in timer zone
-				else {
-					memConsole->error("Implement timers, bitch! {0:x}", address);
-					exit(1);
-				}
-			}
-
-			//	all other reads
-			else {
-				//memConsole->error("Reading from unknown address on I/O range {0:x}", address);
-				//exit(1);
-				return readFromMemory<T>(address);
+		else if (address < IO_START + IO_SIZE) {
+			if (IO::ReadHandler handler = IO::reader<T>(address)) {
+				return (T)handler(address);
 			}
+			return readFromMemory<T>(address);
 		}
 
 
@@ -607,6 +417,12 @@ namespace Memory {
 
 		//	BIOS
 		else if (address < 0x2000'0000) {
+			if (address < BIOS_START + BIOS_SIZE) {
+				return readFromBIOS<T>(address);
+			}
+			if (address == CACHE_CONTROL) {
+				return (T)cacheControl;
+			}
 			return readFromMemory<T>(address);
 		}
 		
@@ -619,12 +435,30 @@ namespace Memory {
 	}
 
 	template <typename T>
-	void store(word address, T data) {
-		address = MASKED_ADDRESS(address);
+	void storeSlow(word address, T data) {
 
-		//	RAM
+		//	watched page
+		if (Debugger::watching && Debugger::isWatchedPage(BLOCK_CACHE_PAGE(address))) {
+			Debugger::write(address, sizeof(T), data, readFromMemory<T>(address));
+		}
+
+		//	lockstep: log the write stream, devices only see the candidate pass
+		if (Lockstep::pass != Lockstep::Pass::Off) {
+			const bool device = LOCKSTEP_DEVICE(address);
+			Lockstep::recordWrite(address, data, sizeof(T), device ? 0 : readFromMemory<T>(address));
+			if (device && Lockstep::pass == Lockstep::Pass::Reference) {
+				return;
+			}
+		}
+
+		//	RAM, the I-cache takes it while the cache is isolated
 		if (address < 0x1f00'0000) {
-			storeToMemory<T>(address, data);
+			if (R3000A::cop[0].sr.flags.isolate_cache) {
+				storeICache<T>(address, data);
+			}
+			else {
+				storeToMemory<T>(address, data);
+			}
 		}
 
 
@@ -634,224 +468,29 @@ namespace Memory {
 		}
 
 
-		//	Scratchpad
+		//	Scratchpad through KSEG1 / past its 1 KiB, dropped
 		else if (address < 0x1f80'1000) {
-			storeToMemory<T>(address, data);
+			return;
 		}
 
 
 		//	I/O
-		else if (address < 0x1f80'2000) {
-
-			//	Memory Control 1
-			if (address >= 0x1f80'1000 && address <= 0x1f80'1020) {
-				memConsole->debug("Writing Memory Control 1 (${0:x})", address);
-				storeToMemory<T>(address, data);
-			}
-
-			//	Memory Control 2 
-			else if (address == 0x1f80'1060) {
-				memConsole->debug("Writing Memory Control 2 (${0:x})", address);
-				storeToMemory<T>(address, data);
-			}
-
-			//	GP0 Send Command
-			else if (address == 0x1f80'1810) {
-				GPU::sendCommandGP0(data);
-			}
-
-			//	GP1 Send Command
-			else if (address == 0x1f80'1814) {
-				GPU::sendCommandGP1(data);
-			}
-
-			//	I_STAT - Interrupt Status Register
-			else if (address == 0x1f80'1070) {
-				I_STAT.raw = data;
-				memConsole->info("Writing to I_STAT (${0:x})", data);
+		else if (address < IO_START + IO_SIZE) {
+			if (IO::WriteHandler handler = IO::writer<T>(address)) {
+				handler(address, data);
 			}
+		}
 
-			//	I_MASK - Interrupt Mask Register
-			else if (address == 0x1f80'1074) {
-				I_MASK.raw = data;
-				memConsole->info("Writing to I_MASK (${0:x})", data);
-			}
 
-			//	DMA Registers
-			else if (address >= 0x1f80'1080 && address < 0x1f80'1100) {
-				u8 channel = (address % 0x1f80'1080) >> 4;
-
-				//	DMA control register
-				if (address == 0x1f80'10f0) {
-					DMA::writeDMAControlRegister(data);
-				}
-
-				//	DMA interrupt register
-				else if (address == 0x1f80'10f4) {
-					DMA::writeDMAInterruptRegister(data);
-				}
-
-				//	DMA base address (for channel N)
-				else if ((address & 0b1111) == 0) {
-					u32 addr = data & 0xff'ffff;
-					DMA::writeDMABaseAddress(addr, channel);
-				}
-
-				//	DMA block control
-				else if ((address & 0b1111) == 4) {
-					DMA::writeDMABlockControl(data, channel);
-				}
-
-				//	DMA channel control
-				else if ((address & 0b1111) == 8) {
-					DMA::writeDMAChannelControl(data, channel);
-				}
-
-				else {
-					memConsole->error("Invalid DMA write at {0:x}", address);
-					exit(1);
-				}
-			}
+		//	BIOS (ROM)
+		else if (address >= BIOS_START && address < BIOS_START + BIOS_SIZE) {
+			return;
+		}
 
-			//	SPU
-			else if (address >= 0x1f80'1c00 && address < 0x1f80'2000) {
-
-				//	Voice volume
-				if (address >= 0x1f80'1c00 && address <= 0x1f80'1d7f) {
-					u8 voice = (address % 0x01f801c00) >> 4;
-					if ((address & 0b1111) == 0) {
-						SPU::writeVoiceVolumeLeft(data, voice);
-					}
-					else if ((address & 0b1111) == 2) {
-						SPU::writeVoiceVolumeRight(data, voice);
-					}
-					else if ((address & 0b1111) == 4) {
-						SPU::writeVoiceADPCMSampleRate(data, voice);
-					}
-				}
-
-				//	SPUSTAT
-				else if (address == 0x1f80'1dae) {
-					SPU::writeSPUSTAT;
-				}
-
-				//	SPUCNT
-				else if (address == 0x1f80'1daa) {
-					SPU::writeSPUCNT(data);
-				}
-
-				//	Mainvolume left
-				else if (address == 0x1f80'1d80) {
-					SPU::writeMainVolumeLeft(data);
-				}
-
-				//	Mainvolume right
-				else if (address == 0x1f80'1d82) {
-					SPU::writeMainVolumeRight(data);
-				}
-
-				//	Reverb output volume left
-				else if (address == 0x1f80'1d84) {
-					SPU::writeReverbOutputVolumeLeft(data);
-				}
-
-				//	Reverb output volume right
-				else if (address == 0x1f80'1d86) {
-					SPU::writeReverbOutputVolumeRight(data);
-				}
-
-				//	Voice Key ON
-				else if (address == 0x1f80'1d88) {
-					SPU::writeVoiceKeyOn(data);
-				}
-				else if (address == 0x1f80'1d8a) {
-					SPU::writeVoiceKeyOn(data, true);
-				}
-
-				//	Voice Key OFF
-				else if (address == 0x1f80'1d8c) {
-					SPU::writeVoiceKeyOff(data);
-				}
-				else if (address == 0x1f80'1d8e) {
-					SPU::writeVoiceKeyOff(data, true);
-				}
-
-				//	Pitch modulation enable flags
-				else if (address == 0x1f80'1d90) {
-					SPU::writePitchModulationEnableFlags(data);
-				}
-				else if (address == 0x1f80'1d92) {
-					SPU::writePitchModulationEnableFlags(data, true);
-				}
-
-				//	Voice Noise
-				else if (address == 0x1f80'1d94) {
-					SPU::writeVoiceNoise(data);
-				}
-				else if (address == 0x1f80'1d96) {
-					SPU::writeVoiceNoise(data, true);
-				}
-
-				//	Voice Reverb Mode
-				else if (address == 0x1f80'1d98) {
-					SPU::writeVoiceReverbMode(data);
-				}
-				else if (address == 0x1f80'1d9a) {
-					SPU::writeVoiceReverbMode(data, true);
-				}
-
-				//	Voice ON/OFF
-				else if (address == 0x1f80'1d9c) {
-					SPU::writeVoiceOnOff(data);
-				}
-
-				//	Sound RAM data reverb work area start address
-				else if (address == 0x1f80'1da2) {
-					SPU::writeSoundRAMDataReverbWorkAreaStartAddress(data);
-				}
-
-				//	Sound RAM data transfer address
-				else if (address == 0x1f80'1da6) {
-					SPU::writeSoundRAMDataTransferAddress(data);
-				}
-
-				//	Sound RAM data transfer fifo
-				else if (address == 0x1f80'1da8) {
-					SPU::writeSoundRAMDataTransferFifo(data);
-				}
-
-				//	Sound RAM data transfer control
-				else if (address == 0x1f80'1dac) {
-					SPU::writeSoundRAMDataTransferControl(data);
-				}
-
-				//	CD audio input volume
-				else if (address == 0x1f80'1db0) {
-					SPU::writeCDAudioInputVolume(data);
-				}
-				else if (address == 0x1f80'1db2) {
-					SPU::writeCDAudioInputVolume(data, true);
-				}
-
-				//	External audio input volume
-				else if (address == 0x1f80'1db4) {
-					SPU::writeExternalAudioInputVolume(data);
-				}
-				else if (address == 0x1f80'1db6) {
-					SPU::writeExternalAudioInputVolume(data, true);
-				}
-
-				//	Reverb configuration
-				else if (address >= 0x1f80'1dc0 && address < 0x1f80'1e00) {
-					SPU::writeReverbConfiguration(data, address - 0x1f80'1dc0);
-				}
-
-				else {
-					memConsole->error("SPU Write detected to {0:x} at size {1:x}", address, sizeof(T));
-					exit(1);
-				}
-			}
 
+		//	Cache Control (FFFE0130h in KSEG2)
+		else if (address == CACHE_CONTROL) {
+			cacheControl = (word)data;
 		}
 
 
@@ -863,8 +502,18 @@ namespace Memory {
 		}
 	}
 
-	void loadToRAM(word, byte*, word, word);
-	void loadBIOS(byte* source, word size);
+	/*
+		Whole ranges at once (DMA, the EXE loader), a page at a time so they can't run past
+		the end of RAM / one of its mirrors. Open bus reads as all ones, writes to it are dropped.
+		Like DMA on the real thing, writeBlock doesn't care about an isolated cache.
+	*/
+	void readBlock(word address, void* destination, word size);
+	void writeBlock(word address, const void* source, word size);
+
+	void mapIO();		//	I_STAT / I_MASK and the memory control registers
+
+	void loadToRAM(word, const byte*, word, word);
+	void loadBIOS(const u8* image);
 	void dumpRAM();
 
 }
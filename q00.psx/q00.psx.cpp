@@ -7,8 +7,51 @@
 #include "timer.h"
 #include "ui.h"
 #include "fileimport.h"
+#include "blockcache.h"
+#include "gte.h"
+#include "recompiler.h"
+#include "hle.h"
+#include "bioscalls.h"
+#include "trace.h"
+#include "lockstep.h"
+#include "debugger.h"
+#include "ir.h"
+#include "emulator.h"
 #include "include/spdlog/spdlog.h"
 #include "include/spdlog/sinks/stdout_color_sinks.h"
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+//  runs every EXE headless in an instance of its own, as many at a time as there are host threads
+static void runBatch(const std::vector<const char*>& exes, u64 cycles) {
+    auto console = spdlog::get("Main");
+    const size_t threads = std::max(1u, std::thread::hardware_concurrency());
+
+    for (size_t first = 0; first < exes.size(); first += threads) {
+        std::vector<std::unique_ptr<Emulator>> instances;
+        std::vector<word> pcs(std::min(threads, exes.size() - first));
+        for (size_t i = 0; i < pcs.size(); i++) {
+            Emulator* emulator = new Emulator();
+            emulator->bios = "scph1001.bin";
+            emulator->exe = exes[first + i];
+            emulator->engine = R3000A::engine;
+            emulator->cycles = cycles;
+            emulator->finished = [&pcs, i]() { pcs[i] = R3000A::registers.pc; };
+            emulator->start();
+            instances.emplace_back(emulator);
+        }
+        for (size_t i = 0; i < instances.size(); i++) {
+            instances[i]->join();
+            console->info("{0:s}: pc {1:08x}", exes[first + i], pcs[i]);
+            if (!instances[i]->tty.empty()) {
+                printf("%s\n", instances[i]->tty.c_str());
+            }
+        }
+    }
+}
 
 int main(int argc, char* argv[]) {
 
@@ -21,11 +64,103 @@ int main(int argc, char* argv[]) {
     //spdlog::set_level(spdlog::level::debug);
     console->info("Starting q00.psx...");
 
+    std::vector<const char*> batch;
+    u64 batchCycles = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--interpreter") == 0) {
+            R3000A::engine = R3000A::Engine::Interpreter;
+        }
+        else if (strcmp(argv[i], "--cached") == 0) {
+            R3000A::engine = R3000A::Engine::CachedInterpreter;
+        }
+        else if (strcmp(argv[i], "--recompiler") == 0) {
+            R3000A::engine = R3000A::Engine::Recompiler;
+        }
+        else if (strcmp(argv[i], "--hle") == 0) {
+            HLE::enabled = true;
+        }
+        else if (strcmp(argv[i], "--profile-bios") == 0) {
+            BIOSCalls::profile = true;
+        }
+        else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            Trace::init(argv[++i]);
+        }
+        else if ((strcmp(argv[i], "--watch") == 0 || strcmp(argv[i], "--watch-read") == 0) && i + 1 < argc) {
+            //  <address>[:<size>], 4 bytes if there's no size
+            const u8 access = argv[i][7] ? Debugger::Read : Debugger::Write;
+            char* end;
+            const word address = strtoul(argv[++i], &end, 16);
+            const word size = *end == ':' ? strtoul(end + 1, nullptr, 0) : 4;
+            Debugger::watch(address, size, access);
+        }
+        else if (strcmp(argv[i], "--break") == 0 && i + 1 < argc) {
+            Debugger::addBreakpoint(strtoul(argv[++i], nullptr, 16));
+        }
+        else if (strcmp(argv[i], "--lockstep") == 0) {
+            Lockstep::enabled = true;
+        }
+        else if (strcmp(argv[i], "--no-ir-opt") == 0) {
+            IR::optimize = false;
+        }
+        else if (strcmp(argv[i], "--no-fastmem") == 0) {
+            Recompiler::fastmem = false;
+        }
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batchCycles = strtoull(argv[++i], nullptr, 0);
+            while (i + 1 < argc) {
+                batch.push_back(argv[++i]);
+            }
+        }
+    }
+
     //  Component init
     FileImport::loadBIOS("scph1001.bin");
     R3000A::init();
+    GTE::init();
     Memory::init();
+    BlockCache::init();
+    if (HLE::enabled && Lockstep::enabled) {
+        console->warn("HLE writes can't be rolled back, --hle is ignored in lockstep mode");
+        HLE::enabled = false;
+    }
+    if (HLE::enabled) {
+        HLE::init();
+    }
+    if (!batch.empty()) {
+        if (Trace::enabled) {
+            console->error("--trace can't be used with --batch");
+            exit(1);
+        }
+        if (BIOSCalls::profile) {
+            console->error("--profile-bios can't be used with --batch");
+            exit(1);
+        }
+        if (Debugger::watching || Debugger::breaking) {
+            console->error("--watch / --break can't be used with --batch");
+            exit(1);
+        }
+        runBatch(batch, batchCycles);
+        return 0;
+    }
+    atexit(R3000A::printIdleLoopStats);
+    if (BIOSCalls::profile) {
+        atexit(BIOSCalls::printProfile);
+    }
+    if (Trace::enabled) {
+        atexit(Trace::save);
+        IR::optimize = false;
+        if (R3000A::engine == R3000A::Engine::Recompiler) {
+            console->warn("Recompiled code can't be traced, using the cached interpreter");
+            R3000A::engine = R3000A::Engine::CachedInterpreter;
+        }
+    }
+    if (R3000A::engine == R3000A::Engine::Recompiler && !Recompiler::init()) {
+        console->warn("Recompiler not available, falling back to the cached interpreter");
+        R3000A::engine = R3000A::Engine::CachedInterpreter;
+    }
     GPU::init();
+    GPU::setupSDL();
     SPU::init();
     //UI::init();
     
@@ -66,7 +201,8 @@ int main(int argc, char* argv[]) {
     // FileImport::loadEXE("CPUXOR.exe"); // - PASSED
     // FileImport::loadEXE("CPUXORI.exe"); // - PASSED
     while (1) {
-        R3000A::step();
+        //  run the CPU for one slice, the hardware is synced in between
+        R3000A::run(DEVICE_SYNC_CYCLES);
         DMA::tick();
         //Timer::tick();
 
@@ -0,0 +1,920 @@
+#include "recompiler.h"
+#include "blockcache.h"
+#include "mmu.h"
+#include "x64emitter.h"
+#include "hle.h"
+#include "bioscalls.h"
+#include "lockstep.h"
+#include "debugger.h"
+#include <stddef.h>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+#include "include/spdlog/spdlog.h"
+#include "include/spdlog/sinks/stdout_color_sinks.h"
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+#if defined(_M_X64) || defined(__x86_64__)
+#define RECOMPILER_SUPPORTED true
+#else
+#define RECOMPILER_SUPPORTED false
+#endif
+#if (defined(_M_X64) || defined(__x86_64__)) && defined(__linux__)
+#define FASTMEM_SUPPORTED true
+#include <signal.h>
+#include <ucontext.h>
+#else
+#define FASTMEM_SUPPORTED false
+#endif
+#define CPU R3000A
+#define PRIMARY_OPCODE(opcode) (opcode >> 26)
+#define SECONDARY_OPCODE(opcode) (opcode & 0x3f)
+#define CODE_BUFFER_SIZE (16 * 1024 * 1024)
+#define MAX_BLOCK_CODE_SIZE ((BLOCK_CACHE_MAX_INSTRUCTIONS + 1) * 0x100)
+#define REG_OFFSET(field) ((i32)offsetof(R3000A::Registers, field))
+#define GPR_OFFSET(i) (REG_OFFSET(r) + 4 * (i))
+#define FAST_RAM_END 0x20'0000
+#define INDIRECT_CACHE_SIZE 0x400
+#define INDIRECT_CACHE_INDEX(a) ((a >> 2) & (INDIRECT_CACHE_SIZE - 1))
+#define INDIRECT_CACHE_EMPTY 1		//	never a valid pc
+
+using namespace X64;
+static auto console = spdlog::stdout_color_mt("Recompiler");
+
+namespace Recompiler {
+
+	typedef void (*BlockFunction)(R3000A::Registers*);
+
+	bool fastmem = true;
+
+	thread_local u8* codeBuffer = nullptr;
+	thread_local Emitter emitter;
+
+	//	set by the stub of an unlinked jump, executeBlock patches it once the target is compiled
+	thread_local BlockCache::Link* pendingLink = nullptr;
+
+	//	targets of JR / JALR, direct mapped by guest address
+	struct IndirectEntry {
+		word address;
+		u8* body;
+	};
+	static_assert(sizeof(IndirectEntry) == 16, "the lookup emitted in emitBlockEnd scales the index by 16");
+	thread_local IndirectEntry indirectCache[INDIRECT_CACHE_SIZE];
+
+#ifdef _WIN32
+	const Reg ARG1 = RCX;
+	const Reg ARG2 = RDX;
+#else
+	const Reg ARG1 = RDI;
+	const Reg ARG2 = RSI;
+#endif
+
+	//	early block exits (block invalidated by one of its own stores)
+	struct Exit {
+		u8* jump;
+		u32 cycles;			//	used up to and including the instruction at address
+		word address;		//	guest address of the instruction that caused it
+		bool pcFlushed;		//	whether pc / next_pc in memory are already up to date
+	};
+
+	/*
+		Fastmem: loads / stores are a plain host access into Memory::window, the address in RAX,
+		the value of a store in RCX. Anything that isn't plain memory faults, the handler turns
+		the site into a jump to its slow path for good and continues there.
+	*/
+	struct FastmemAccess {
+		u8* start;			//	where the jump to the slow path goes
+		u8* access;			//	the host load / store that faults
+		u8* resume;			//	right after it
+		word address;		//	guest address of the instruction
+		u32 cycles;
+		u8 size;
+		bool store;
+		bool delaySlot;
+	};
+
+	//	sites of the block being compiled, their slow paths come after its end
+	thread_local std::vector<FastmemAccess> fastmemAccesses;
+
+	//	slow path and patch location by the address of the faulting host instruction
+	struct FastmemSite {
+		u8* start;
+		u8* slowPath;
+		bool store;
+	};
+	thread_local std::unordered_map<const u8*, FastmemSite> fastmemSites;
+
+	void* compile(BlockCache::Block* block);
+	bool compileOp(const IR::Op& op, std::vector<Exit>& exits, BlockCache::Block* block, u32 cycles);
+	bool compileInstruction(const R3000A::Instruction& instr, word address, std::vector<Exit>& exits, BlockCache::Block* block, u32 cycles, bool delaySlot);
+	void emitBlockEnd(BlockCache::Block* block, u32 cycles);
+	void emitSlowPaths(BlockCache::Block* block, std::vector<Exit>& exits);
+	bool installFaultHandler();
+	void clearIndirectCache();
+	bool linkable(const BlockCache::Block* block);
+}
+
+bool Recompiler::init() {
+	if (!RECOMPILER_SUPPORTED) {
+		console->error("Recompiler needs a x86-64 host");
+		return false;
+	}
+
+#ifdef _WIN32
+	codeBuffer = (u8*)VirtualAlloc(nullptr, CODE_BUFFER_SIZE, MEM_RESERVE | MEM_COMMIT, PAGE_EXECUTE_READWRITE);
+#else
+	codeBuffer = (u8*)mmap(nullptr, CODE_BUFFER_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (codeBuffer == MAP_FAILED) {
+		codeBuffer = nullptr;
+	}
+#endif
+	if (!codeBuffer) {
+		console->error("Could not allocate executable memory");
+		return false;
+	}
+
+	emitter.reset(codeBuffer, CODE_BUFFER_SIZE);
+	clearIndirectCache();
+
+	if (fastmem) {
+		if (installFaultHandler() && Memory::mapWindow()) {
+			console->info("Fastmem window at {0}", (void*)Memory::window);
+		}
+		else {
+			console->warn("Fastmem not available, using range checks");
+		}
+	}
+	console->info("Recompiler init");
+	return true;
+}
+
+void Recompiler::reset() {
+	BlockCache::flush();
+	clearIndirectCache();
+	pendingLink = nullptr;
+	fastmemSites.clear();
+	emitter.reset(codeBuffer, CODE_BUFFER_SIZE);
+}
+
+void Recompiler::shutdown() {
+	if (!codeBuffer) {
+		return;
+	}
+	BlockCache::flush();
+	clearIndirectCache();
+	pendingLink = nullptr;
+	fastmemSites.clear();
+	Memory::unmapWindow();
+#ifdef _WIN32
+	VirtualFree(codeBuffer, 0, MEM_RELEASE);
+#else
+	munmap(codeBuffer, CODE_BUFFER_SIZE);
+#endif
+	codeBuffer = nullptr;
+}
+
+#if FASTMEM_SUPPORTED
+static struct sigaction previousFaultHandler;
+
+static void onFault(int signal, siginfo_t* info, void* context) {
+	ucontext_t* state = (ucontext_t*)context;
+	const u8* rip = (const u8*)state->uc_mcontext.gregs[REG_RIP];
+	const u8* address = (const u8*)info->si_addr;
+	auto site = Recompiler::fastmemSites.find(rip);
+
+	if (Memory::window && address >= Memory::window && address < Memory::window + MEMORY_WINDOW_SIZE && site != Recompiler::fastmemSites.end()) {
+
+		//	first store to a clean RAM page, once it's marked dirty the store can run again
+		const word guest = MASKED_ADDRESS((word)(address - Memory::window));
+		if (site->second.store && guest < RAM_MIRRORS_END && !Memory::isDirtyPage(BLOCK_CACHE_PAGE(guest))) {
+			Memory::markDirtyPage(BLOCK_CACHE_PAGE(guest));
+			if (Memory::writePages[guest >> MEMORY_PAGE_SHIFT]) {
+				return;
+			}
+		}
+		Emitter::patchJump(site->second.start, site->second.slowPath);
+		state->uc_mcontext.gregs[REG_RIP] = (greg_t)site->second.slowPath;
+		return;
+	}
+
+	//	not a fastmem access, whatever handled it before gets it. This handler stays installed,
+	//	other threads still need it. Without a previous handler the process dies as it would have
+	if (previousFaultHandler.sa_flags & SA_SIGINFO) {
+		previousFaultHandler.sa_sigaction(signal, info, context);
+		return;
+	}
+	if (previousFaultHandler.sa_handler != SIG_DFL && previousFaultHandler.sa_handler != SIG_IGN) {
+		previousFaultHandler.sa_handler(signal);
+		return;
+	}
+	struct sigaction fallback = {};
+	fallback.sa_handler = SIG_DFL;
+	sigemptyset(&fallback.sa_mask);
+	sigaction(SIGSEGV, &fallback, nullptr);
+	raise(SIGSEGV);
+}
+#endif
+
+//	once for all instances, every thread has its own window and sites
+bool Recompiler::installFaultHandler() {
+#if FASTMEM_SUPPORTED
+	static std::once_flag once;
+	static bool installed = false;
+	std::call_once(once, [] {
+		struct sigaction action = {};
+		action.sa_sigaction = onFault;
+		action.sa_flags = SA_SIGINFO;
+		sigemptyset(&action.sa_mask);
+		installed = sigaction(SIGSEGV, &action, &previousFaultHandler) == 0;
+	});
+	return installed;
+#else
+	return false;
+#endif
+}
+
+void Recompiler::clearIndirectCache() {
+	for (IndirectEntry& entry : indirectCache) {
+		entry.address = INDIRECT_CACHE_EMPTY;
+		entry.body = nullptr;
+	}
+}
+
+void Recompiler::unlink(BlockCache::Block* block) {
+	if (!block->code) {
+		return;
+	}
+
+	//	jumps into this block go back to their stubs
+	for (BlockCache::Link* link : block->incoming) {
+		emitter.bindTo(link->jump, link->stub);
+		link->to = nullptr;
+	}
+	block->incoming.clear();
+
+	//	and its own links won't need unpatching anymore
+	for (BlockCache::Link& link : block->links) {
+		if (link.to) {
+			std::vector<BlockCache::Link*>& list = link.to->incoming;
+			list.erase(std::remove(list.begin(), list.end(), &link), list.end());
+			link.to = nullptr;
+		}
+	}
+	if (pendingLink && pendingLink->from == block) {
+		pendingLink = nullptr;
+	}
+
+	IndirectEntry& entry = indirectCache[INDIRECT_CACHE_INDEX(block->address)];
+	if (entry.body == block->body) {
+		entry.address = INDIRECT_CACHE_EMPTY;
+		entry.body = nullptr;
+	}
+}
+
+//	entering a block has to go through executeBlock for HLE / thunk calls, idle loop detection and
+//	breakpoints, the BIOS call profiler has to see every block entry (returns from the calls).
+//	Lockstep compares the engines after every block, so nothing gets linked while it runs
+bool Recompiler::linkable(const BlockCache::Block* block) {
+	const word address = MASKED_ADDRESS(block->address);
+	return block->body && !block->idle_candidate && !block->breakpoint && !BIOSCalls::profile && !Lockstep::enabled && address != 0xa0 && address != 0xb0 && address != 0xc0;
+}
+
+//	guest register -> host register, r0 reads as 0
+static void loadGPR(Emitter& e, Reg dst, u8 gpr) {
+	if (gpr == 0) {
+		e.movImm(dst, 0);
+	}
+	else {
+		e.movLoad(dst, RBX, GPR_OFFSET(gpr));
+	}
+}
+
+//	host register -> guest register, writes to r0 are dropped
+static void storeGPR(Emitter& e, u8 gpr, Reg src) {
+	if (gpr != 0) {
+		e.movStore(RBX, GPR_OFFSET(gpr), src);
+	}
+}
+
+//	pc / next_pc as they are after the instruction at address started executing (outside of a delay slot)
+static void storePC(Emitter& e, word address) {
+	e.movStoreImm(RBX, REG_OFFSET(pc), address + 4);
+	e.movStoreImm(RBX, REG_OFFSET(next_pc), address + 8);
+}
+
+static void emitReturn(Emitter& e) {
+	e.addRSP(0x20);
+	e.pop(RBX);
+	e.ret();
+}
+
+//	blocks add their cycles to CPU::cycles themselves, a chain of linked blocks returns only once
+static void emitEpilogue(Emitter& e, u32 cycles) {
+	e.movImm64(RAX, (u64)&CPU::cycles);
+	e.add64MemImm(RAX, 0, cycles);
+	emitReturn(e);
+}
+
+//	where the block continues if that's known when compiling it, JR / JALR are indirect
+static u32 successors(const BlockCache::Block* block, word targets[2], bool& indirect) {
+	const size_t count = block->instructions.size();
+	const word lastAddress = block->address + 4 * (word)(count - 1);
+	indirect = false;
+
+	if (count >= 2 && block->instructions[count - 2].has_delay_slot) {
+		const R3000A::Instruction& branch = block->instructions[count - 2];
+		const word address = lastAddress - 4;
+		const u8 primary = PRIMARY_OPCODE(branch.opcode);
+		if (primary == 0x02 || primary == 0x03) {
+			targets[0] = R3000A::jumpTarget(address, branch);
+			return 1;
+		}
+		if (primary == 0x01 || (primary >= 0x04 && primary <= 0x07)) {
+			targets[0] = address + 4 + ((u32)SIGN_EXT32(branch.imm16) << 2);
+			targets[1] = address + 8;
+			return 2;
+		}
+		indirect = true;
+		return 0;
+	}
+
+	//	syscall / break / .. go to the exception vector. A branch without its delay slot (it
+	//	couldn't be fetched) goes back to executeBlock, which raises the bus error for the slot
+	if (block->instructions.back().ends_block || block->instructions.back().has_delay_slot) {
+		return 0;
+	}
+
+	//	ran into the size limit
+	targets[0] = lastAddress + 4;
+	return 1;
+}
+
+//	the inline part of a fastmem access, address in RAX, store value in RCX, loads end up in RAX
+static void emitFastmemAccess(Emitter& e, u8 size, bool store, word address, u32 cycles, bool delaySlot) {
+	Recompiler::FastmemAccess access = { e.ptr, nullptr, nullptr, address, cycles, size, store, delaySlot };
+	e.movImm64(RDX, (u64)Memory::window);
+	access.access = e.ptr;
+	switch (size) {
+		case 1: store ? e.movStore8Indexed(RDX, RAX, RCX) : e.movzx8Indexed(RAX, RDX, RAX); break;
+		case 2: store ? e.movStore16Indexed(RDX, RAX, RCX) : e.movzx16Indexed(RAX, RDX, RAX); break;
+		case 4: store ? e.movStoreIndexed(RDX, RAX, RCX) : e.movLoadIndexed(RAX, RDX, RAX); break;
+	}
+	access.resume = e.ptr;
+	Recompiler::fastmemAccesses.push_back(access);
+}
+
+//	lockstep has to see every write, so stores keep calling Memory::store there
+static bool fastmemStores() {
+	return Memory::window && !Lockstep::enabled;
+}
+
+bool Recompiler::compileInstruction(const R3000A::Instruction& instr, word address, std::vector<Exit>& exits, BlockCache::Block* block, u32 cycles, bool delaySlot) {
+	Emitter& e = emitter;
+	const word opcode = instr.opcode;
+	const u32 simm = (u32)SIGN_EXT32(instr.imm16);
+	const u32 zimm = (u16)instr.imm16;
+
+	//	conditional branches, target relative to the delay slot
+	auto branch = [&](Cond taken, bool compareRT) {
+		const word target = address + 4 + (simm << 2);
+		loadGPR(e, RAX, instr.rs);
+		if (compareRT) {
+			loadGPR(e, RCX, instr.rt);
+			e.alu(ALU::CMP, RAX, RCX);
+		}
+		else {
+			e.aluImm(ALU::CMP, RAX, 0);
+		}
+		e.movStoreImm(RBX, REG_OFFSET(pc), address + 4);
+		e.movStoreImm(RBX, REG_OFFSET(next_pc), address + 8);
+		u8* notTaken = e.jcc((Cond)((u8)taken ^ 1));
+		e.movStoreImm(RBX, REG_OFFSET(next_pc), target);
+		e.bind(notTaken);
+	};
+
+	//	loads with a direct path into main RAM (or fastmem), everything else goes through Memory::fetch
+	auto load = [&](u8 size, bool signExtend) {
+		const u32 alignMask = ~(u32)(size - 1);
+		loadGPR(e, RAX, instr.rs);
+		e.aluImm(ALU::ADD, RAX, simm);
+
+		if (Memory::window) {
+			if (size > 1) {
+				e.aluImm(ALU::AND, RAX, alignMask);
+			}
+			emitFastmemAccess(e, size, false, address, cycles, delaySlot);
+			if (signExtend) {
+				(size == 1) ? e.movsx8(RAX, RAX) : e.movsx16(RAX, RAX);
+			}
+			storeGPR(e, instr.rt, RAX);
+			return;
+		}
+
+		//	watched RAM pages have to take the slow path, so there's no direct one while watching
+		u8* done = nullptr;
+		if (!Debugger::watching) {
+			e.mov(RCX, RAX);
+			e.aluImm(ALU::AND, RCX, 0x1fff'ffff & alignMask);
+			e.aluImm(ALU::CMP, RCX, FAST_RAM_END);
+			u8* slow = e.jcc(Cond::AE);
+			e.movImm64(RDX, (u64)&Memory::memory);
+			e.movLoad64(RDX, RDX);
+			e.add64(RDX, RCX);
+			switch (size) {
+				case 1: e.movzx8Indirect(RAX, RDX); break;
+				case 2: e.movzx16Indirect(RAX, RDX); break;
+				case 4: e.movLoadIndirect(RAX, RDX); break;
+			}
+			done = e.jmp();
+			e.bind(slow);
+		}
+
+		e.movStoreImm(RBX, REG_OFFSET(log_pc), address);
+		e.mov(ARG1, RAX);
+		switch (size) {
+			case 1: e.call((const void*)&Memory::fetch<byte>); e.movzx8(RAX, RAX); break;
+			case 2: e.call((const void*)&Memory::fetch<hword>); e.movzx16(RAX, RAX); break;
+			case 4: e.call((const void*)&Memory::fetch<word>); break;
+		}
+		if (done) {
+			e.bind(done);
+		}
+
+		if (signExtend) {
+			(size == 1) ? e.movsx8(RAX, RAX) : e.movsx16(RAX, RAX);
+		}
+		storeGPR(e, instr.rt, RAX);
+	};
+
+	//	stores go through Memory::store, they might hit code of this very block. With fastmem
+	//	code pages are read only, so those take the slow path as well
+	auto store = [&](u8 size) {
+		loadGPR(e, RAX, instr.rs);
+		e.aluImm(ALU::ADD, RAX, simm);
+		if (fastmemStores()) {
+			if (size > 1) {
+				e.aluImm(ALU::AND, RAX, ~(u32)(size - 1));
+			}
+			loadGPR(e, RCX, instr.rt);
+			emitFastmemAccess(e, size, true, address, cycles, delaySlot);
+			return;
+		}
+		e.mov(ARG1, RAX);
+		loadGPR(e, ARG2, instr.rt);
+		e.movStoreImm(RBX, REG_OFFSET(log_pc), address);
+		switch (size) {
+			case 1: e.call((const void*)&Memory::store<byte>); break;
+			case 2: e.call((const void*)&Memory::store<hword>); break;
+			case 4: e.call((const void*)&Memory::store<word>); break;
+		}
+		e.movImm64(RAX, (u64)&block->valid);
+		e.cmpByteIndirect(RAX, 0);
+		exits.push_back({ e.jcc(Cond::E), cycles, address, delaySlot });
+	};
+
+	auto aluRR = [&](ALU op) {
+		if (instr.rd == 0) return;
+		loadGPR(e, RAX, instr.rs);
+		loadGPR(e, RCX, instr.rt);
+		e.alu(op, RAX, RCX);
+		storeGPR(e, instr.rd, RAX);
+	};
+
+	auto aluRI = [&](ALU op, u32 imm, u8 source) {
+		if (instr.rt == 0) return;
+		loadGPR(e, RAX, source);
+		e.aluImm(op, RAX, imm);
+		storeGPR(e, instr.rt, RAX);
+	};
+
+	auto setLess = [&](Cond cc, bool immediate) {
+		u8 dst = immediate ? instr.rt : instr.rd;
+		if (dst == 0) return;
+		loadGPR(e, RAX, instr.rs);
+		if (immediate) {
+			e.aluImm(ALU::CMP, RAX, simm);
+		}
+		else {
+			loadGPR(e, RCX, instr.rt);
+			e.alu(ALU::CMP, RAX, RCX);
+		}
+		e.setcc(cc, RAX);
+		e.movzx8(RAX, RAX);
+		storeGPR(e, dst, RAX);
+	};
+
+	auto shiftImm = [&](Shift op) {
+		if (instr.rd == 0) return;
+		loadGPR(e, RAX, instr.rt);
+		e.shiftImm(op, RAX, instr.imm5);
+		storeGPR(e, instr.rd, RAX);
+	};
+
+	auto shiftVar = [&](Shift op) {
+		if (instr.rd == 0) return;
+		loadGPR(e, RAX, instr.rt);
+		loadGPR(e, RCX, instr.rs);
+		e.shiftCL(op, RAX);
+		storeGPR(e, instr.rd, RAX);
+	};
+
+	//	COP instructions and branches in delay slots always go to the interpreter
+	if ((opcode & 0x4000'0000) || (delaySlot && instr.has_delay_slot)) {
+		return false;
+	}
+
+	switch (PRIMARY_OPCODE(opcode)) {
+		case 0x00:
+			switch (SECONDARY_OPCODE(opcode)) {
+				case 0x00: if (opcode != 0) shiftImm(Shift::SHL); return true;
+				case 0x02: shiftImm(Shift::SHR); return true;
+				case 0x03: shiftImm(Shift::SAR); return true;
+				case 0x04: shiftVar(Shift::SHL); return true;
+				case 0x06: shiftVar(Shift::SHR); return true;
+				case 0x07: shiftVar(Shift::SAR); return true;
+				case 0x10:
+					if (instr.rd != 0) {
+						e.movLoad(RAX, RBX, REG_OFFSET(hi));
+						storeGPR(e, instr.rd, RAX);
+					}
+					return true;
+				case 0x11: loadGPR(e, RAX, instr.rs); e.movStore(RBX, REG_OFFSET(hi), RAX); return true;
+				case 0x12:
+					if (instr.rd != 0) {
+						e.movLoad(RAX, RBX, REG_OFFSET(lo));
+						storeGPR(e, instr.rd, RAX);
+					}
+					return true;
+				case 0x13: loadGPR(e, RAX, instr.rs); e.movStore(RBX, REG_OFFSET(lo), RAX); return true;
+				case 0x18:
+				case 0x19:
+					loadGPR(e, RAX, instr.rs);
+					loadGPR(e, RCX, instr.rt);
+					(SECONDARY_OPCODE(opcode) == 0x18) ? e.imul(RCX) : e.mul(RCX);
+					e.movStore(RBX, REG_OFFSET(lo), RAX);
+					e.movStore(RBX, REG_OFFSET(hi), RDX);
+					return true;
+				case 0x20:
+				case 0x21: aluRR(ALU::ADD); return true;
+				case 0x22:
+				case 0x23: aluRR(ALU::SUB); return true;
+				case 0x24: aluRR(ALU::AND); return true;
+				case 0x25: aluRR(ALU::OR); return true;
+				case 0x26: aluRR(ALU::XOR); return true;
+				case 0x27:
+					if (instr.rd == 0) return true;
+					loadGPR(e, RAX, instr.rs);
+					loadGPR(e, RCX, instr.rt);
+					e.alu(ALU::OR, RAX, RCX);
+					e.notReg(RAX);
+					storeGPR(e, instr.rd, RAX);
+					return true;
+				case 0x2a: setLess(Cond::L, false); return true;
+				case 0x2b: setLess(Cond::B, false); return true;
+			}
+			return false;
+
+		//	J / JAL
+		case 0x02:
+		case 0x03: {
+			const word target = R3000A::jumpTarget(address, instr);
+			if (PRIMARY_OPCODE(opcode) == 0x03) {
+				e.movStoreImm(RBX, GPR_OFFSET(31), address + 8);
+			}
+			e.movStoreImm(RBX, REG_OFFSET(pc), address + 4);
+			e.movStoreImm(RBX, REG_OFFSET(next_pc), target);
+			return true;
+		}
+		case 0x04: branch(Cond::E, true); return true;
+		case 0x05: branch(Cond::NE, true); return true;
+		case 0x06: branch(Cond::LE, false); return true;
+		case 0x07: branch(Cond::G, false); return true;
+		case 0x08:
+		case 0x09: aluRI(ALU::ADD, simm, instr.rs); return true;
+		case 0x0a: setLess(Cond::L, true); return true;
+		case 0x0b: setLess(Cond::B, true); return true;
+		case 0x0c: aluRI(ALU::AND, zimm, instr.rs); return true;
+		case 0x0d: aluRI(ALU::OR, zimm, instr.rs); return true;
+		case 0x0e: aluRI(ALU::XOR, zimm, instr.rs); return true;
+		case 0x0f:
+			if (instr.rt != 0) {
+				e.movStoreImm(RBX, GPR_OFFSET(instr.rt), zimm << 16);
+			}
+			return true;
+		case 0x20: load(1, true); return true;
+		case 0x21: load(2, true); return true;
+		case 0x23: load(4, false); return true;
+		case 0x24: load(1, false); return true;
+		case 0x25: load(2, false); return true;
+		case 0x28: store(1); return true;
+		case 0x29: store(2); return true;
+		case 0x2b: store(4); return true;
+	}
+
+	return false;
+}
+
+//	the IR's own kinds, Guest / ALU ops are left to compileInstruction
+bool Recompiler::compileOp(const IR::Op& op, std::vector<Exit>& exits, BlockCache::Block* block, u32 cycles) {
+	Emitter& e = emitter;
+
+	switch (op.kind) {
+		case IR::Kind::Nop:
+			return true;
+
+		case IR::Kind::Const:
+			e.movStoreImm(RBX, GPR_OFFSET(op.rd), op.value);
+			return true;
+
+		//	known address in main RAM / the scratchpad, no range check / slow path
+		case IR::Kind::LoadRAM:
+		case IR::Kind::LoadScratchpad:
+			if (op.kind == IR::Kind::LoadRAM) {
+				e.movImm64(RDX, (u64)&Memory::memory);
+				e.movImm(RCX, op.value & ~(u32)(op.size - 1));
+			}
+			else {
+				e.movImm64(RDX, (u64)&Memory::scratchpad);
+				e.movImm(RCX, op.value & (SCRATCHPAD_SIZE - op.size));
+			}
+			e.movLoad64(RDX, RDX);
+			e.add64(RDX, RCX);
+			switch (PRIMARY_OPCODE(op.instr->opcode)) {
+				case 0x20: e.movzx8Indirect(RAX, RDX); e.movsx8(RAX, RAX); break;
+				case 0x21: e.movzx16Indirect(RAX, RDX); e.movsx16(RAX, RAX); break;
+				case 0x23: e.movLoadIndirect(RAX, RDX); break;
+				case 0x24: e.movzx8Indirect(RAX, RDX); break;
+				case 0x25: e.movzx16Indirect(RAX, RDX); break;
+			}
+			storeGPR(e, op.rd, RAX);
+			return true;
+
+		//	still has to look after code in that page, but skips the region ladder of Memory::store
+		case IR::Kind::StoreRAM:
+			if (fastmemStores()) {
+				e.movImm(RAX, op.value & ~(u32)(op.size - 1));
+				loadGPR(e, RCX, op.rt);
+				emitFastmemAccess(e, op.size, true, op.address, cycles, op.delaySlot);
+				return true;
+			}
+			e.movImm(ARG1, op.value);
+			loadGPR(e, ARG2, op.rt);
+			e.movStoreImm(RBX, REG_OFFSET(log_pc), op.address);
+			switch (op.size) {
+				case 1: e.call((const void*)&Memory::storeRAM<byte>); break;
+				case 2: e.call((const void*)&Memory::storeRAM<hword>); break;
+				case 4: e.call((const void*)&Memory::storeRAM<word>); break;
+			}
+			e.movImm64(RAX, (u64)&block->valid);
+			e.cmpByteIndirect(RAX, 0);
+			exits.push_back({ e.jcc(Cond::E), cycles, op.address, op.delaySlot });
+			return true;
+
+		//	no code can come from the scratchpad, so the block is still valid afterwards
+		case IR::Kind::StoreScratchpad:
+			if (fastmemStores()) {
+				e.movImm(RAX, op.value & ~(u32)(op.size - 1));
+				loadGPR(e, RCX, op.rt);
+				emitFastmemAccess(e, op.size, true, op.address, cycles, op.delaySlot);
+				return true;
+			}
+			e.movImm(ARG1, op.value);
+			loadGPR(e, ARG2, op.rt);
+			switch (op.size) {
+				case 1: e.call((const void*)&Memory::storeScratchpad<byte>); break;
+				case 2: e.call((const void*)&Memory::storeScratchpad<hword>); break;
+				case 4: e.call((const void*)&Memory::storeScratchpad<word>); break;
+			}
+			return true;
+
+		default:
+			return false;
+	}
+}
+
+void* Recompiler::compile(BlockCache::Block* block) {
+	if (emitter.remaining() < MAX_BLOCK_CODE_SIZE) {
+		return nullptr;
+	}
+
+	Emitter& e = emitter;
+	u8* code = e.ptr;
+	std::vector<Exit> exits;
+	fastmemAccesses.clear();
+
+	e.push(RBX);
+	e.subRSP(0x20);
+	e.mov64(RBX, ARG1);
+	block->body = e.ptr;
+
+	bool pcFlushed = false;
+	u32 cycles = 0;
+	for (u32 i = 0; i < block->ir.size(); i++) {
+		const IR::Op& op = block->ir[i];
+		const R3000A::Instruction& instr = *op.instr;
+		const word address = op.address;
+		const bool delaySlot = op.delaySlot;
+		cycles += op.cycles;
+
+		//	branch delay slot: pc = next_pc, next_pc += 4
+		if (delaySlot) {
+			e.movLoad(RAX, RBX, REG_OFFSET(next_pc));
+			e.movStore(RBX, REG_OFFSET(pc), RAX);
+			e.aluImm(ALU::ADD, RAX, 4);
+			e.movStore(RBX, REG_OFFSET(next_pc), RAX);
+		}
+
+		if (compileOp(op, exits, block, cycles) || compileInstruction(instr, address, exits, block, cycles, delaySlot)) {
+			pcFlushed = delaySlot || instr.has_delay_slot;
+		}
+
+		//	fall back to the interpreter
+		else {
+			if (!delaySlot) {
+				storePC(e, address);
+			}
+			e.movStoreImm(RBX, REG_OFFSET(log_pc), address);
+			e.movImm64(ARG1, (u64)&instr);
+			e.call((const void*)instr.handler);
+			pcFlushed = true;
+
+			//	left the block (exception) or the block overwrote itself
+			if (!instr.ends_block && !delaySlot && i + 1 < block->ir.size()) {
+				e.movLoad(RAX, RBX, REG_OFFSET(pc));
+				e.aluImm(ALU::CMP, RAX, address + 4);
+				exits.push_back({ e.jcc(Cond::NE), cycles, address, true });
+				e.movImm64(RAX, (u64)&block->valid);
+				e.cmpByteIndirect(RAX, 0);
+				exits.push_back({ e.jcc(Cond::E), cycles, address, true });
+			}
+		}
+	}
+
+	if (!pcFlushed) {
+		storePC(e, block->ir.back().address);
+	}
+	emitBlockEnd(block, cycles);
+	emitSlowPaths(block, exits);
+
+	for (const Exit& exit : exits) {
+		e.bind(exit.jump);
+		if (!exit.pcFlushed) {
+			storePC(e, exit.address);
+		}
+		emitEpilogue(e, exit.cycles);
+	}
+
+	return code;
+}
+
+/*
+	End of the block: once the budget is checked, pc is compared against the known successors.
+	Their jumps start out pointing at a stub that returns to executeBlock, which patches them
+	to the successor's body the next time around. JR / JALR look their target up in the
+	indirect cache instead. Every block has the same prologue, so RBX and the stack frame
+	stay as they are. Idle loop candidates, and every block under --lockstep, always return.
+*/
+void Recompiler::emitBlockEnd(BlockCache::Block* block, u32 cycles) {
+	Emitter& e = emitter;
+	e.movImm64(RAX, (u64)&CPU::cycles);
+	e.add64MemImm(RAX, 0, cycles);
+
+	word targets[2];
+	bool indirect = false;
+	const bool chained = !block->idle_candidate && !Lockstep::enabled;
+	const u32 count = chained ? successors(block, targets, indirect) : 0;
+	if (count == 0 && (!chained || !indirect)) {
+		emitReturn(e);
+		return;
+	}
+
+	std::vector<u8*> leave;
+	e.movLoad64(RCX, RAX);
+	e.movImm64(RAX, (u64)&CPU::nextEventCycle);
+	e.movLoad64(RAX, RAX);
+	e.cmp64(RCX, RAX);
+	leave.push_back(e.jcc(Cond::AE));
+
+	e.movLoad(RAX, RBX, REG_OFFSET(pc));
+	for (u32 i = 0; i < count; i++) {
+		BlockCache::Link& link = block->links[i];
+		link.from = block;
+		link.target = targets[i];
+		e.aluImm(ALU::CMP, RAX, targets[i]);
+		u8* other = e.jcc(Cond::NE);
+		link.jump = e.jmp();
+		e.bind(other);
+	}
+
+	if (indirect) {
+		e.mov(RCX, RAX);
+		e.shiftImm(Shift::SHR, RCX, 2);
+		e.aluImm(ALU::AND, RCX, INDIRECT_CACHE_SIZE - 1);
+		e.shiftImm(Shift::SHL, RCX, 4);
+		e.movImm64(RDX, (u64)indirectCache);
+		e.add64(RDX, RCX);
+		e.movLoadIndirect(RCX, RDX);
+		e.alu(ALU::CMP, RAX, RCX);
+		leave.push_back(e.jcc(Cond::NE));
+		e.movLoad64(RDX, RDX, (i32)offsetof(IndirectEntry, body));
+		e.jmpReg(RDX);
+	}
+
+	for (u8* jump : leave) {
+		e.bind(jump);
+	}
+	emitReturn(e);
+
+	for (u32 i = 0; i < count; i++) {
+		BlockCache::Link& link = block->links[i];
+		link.stub = e.ptr;
+		e.bind(link.jump);
+		e.movImm64(RAX, (u64)&link);
+		e.movImm64(RCX, (u64)&pendingLink);
+		e.movStore64(RCX, 0, RAX);
+		emitReturn(e);
+	}
+}
+
+//	Memory::fetch / store for the fastmem sites of the block, only entered once a site faulted
+void Recompiler::emitSlowPaths(BlockCache::Block* block, std::vector<Exit>& exits) {
+	Emitter& e = emitter;
+	for (const FastmemAccess& access : fastmemAccesses) {
+		fastmemSites[access.access] = { access.start, e.ptr, access.store };
+		e.movStoreImm(RBX, REG_OFFSET(log_pc), access.address);
+
+		if (access.store) {
+			e.mov(ARG2, RCX);
+			e.mov(ARG1, RAX);
+			switch (access.size) {
+				case 1: e.call((const void*)&Memory::store<byte>); break;
+				case 2: e.call((const void*)&Memory::store<hword>); break;
+				case 4: e.call((const void*)&Memory::store<word>); break;
+			}
+			e.movImm64(RAX, (u64)&block->valid);
+			e.cmpByteIndirect(RAX, 0);
+			exits.push_back({ e.jcc(Cond::E), access.cycles, access.address, access.delaySlot });
+		}
+		else {
+			e.mov(ARG1, RAX);
+			switch (access.size) {
+				case 1: e.call((const void*)&Memory::fetch<byte>); e.movzx8(RAX, RAX); break;
+				case 2: e.call((const void*)&Memory::fetch<hword>); e.movzx16(RAX, RAX); break;
+				case 4: e.call((const void*)&Memory::fetch<word>); break;
+			}
+		}
+		e.bindTo(e.jmp(), access.resume);
+	}
+}
+
+//	returns the cycles used
+u32 Recompiler::executeBlock() {
+
+	word opcode;
+	if (!Memory::fetchInstruction(CPU::registers.pc, opcode)) {
+		return CPU::instructionBusError();
+	}
+	BIOSCalls::enter(CPU::registers.pc);
+	if (const u32 used = HLE::call(CPU::registers.pc)) {
+		return used;
+	}
+
+	BlockCache::Block* block = BlockCache::lookup(CPU::registers.pc);
+
+	if (!block->code) {
+		block->code = compile(block);
+
+		//	out of code space, start over
+		if (!block->code) {
+			console->info("Code buffer full, flushing");
+			reset();
+			block = BlockCache::lookup(CPU::registers.pc);
+			block->code = compile(block);
+		}
+	}
+	if (block->breakpoint) {
+		Debugger::breakpoint(block->address);
+	}
+
+	//	patch the jump that asked for this block, and remember it for JR / JALR
+	if (linkable(block)) {
+		if (pendingLink && pendingLink->target == block->address) {
+			emitter.bindTo(pendingLink->jump, block->body);
+			pendingLink->to = block;
+			block->incoming.push_back(pendingLink);
+		}
+		indirectCache[INDIRECT_CACHE_INDEX(block->address)] = { block->address, block->body };
+	}
+	pendingLink = nullptr;
+
+	const u64 before = CPU::cycles;
+	((BlockFunction)block->code)(&CPU::registers);
+	const u32 used = (u32)(CPU::cycles - before);
+	CPU::checkIdleLoop(block);
+	return used;
+}
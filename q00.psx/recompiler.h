@@ -0,0 +1,29 @@
+#pragma once
+#ifndef RECOMPILER_GUARD
+#define RECOMPILER_GUARD
+#include "defs.h"
+#include "cpu.h"
+
+/*
+	x86-64 dynamic recompiler for the R3000A.
+	Works on the blocks of the BlockCache: simple ALU ops, branches and loads / stores
+	are translated to host code, everything else (COP0, exceptions, unaligned accesses, ..)
+	calls back into the interpreter's handler of the pre-decoded instruction.
+	Blocks are linked: a block ending in a static jump / branch (or just running into the
+	next one) jumps straight into its successor once that got compiled, JR / JALR go through
+	a small cache of recently entered blocks. Control only comes back to executeBlock when
+	the cycle budget is used up, for idle loops and the HLE / thunk entry points.
+	On Linux loads / stores use the fastmem window of Memory, see FastmemAccess.
+*/
+namespace Recompiler {
+
+	extern bool fastmem;		//	--no-fastmem
+
+	bool init();	//	false if the host can't run recompiled code
+	u32 executeBlock();
+	void reset();
+	void shutdown();
+	void unlink(BlockCache::Block* block);		//	the block is about to go away, nothing may jump into it anymore
+}
+
+#endif
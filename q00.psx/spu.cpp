@@ -1,10 +1,12 @@
 #include "spu.h"
+#include "io.h"
+#define SPU_VOICE(address) ((address - 0x1f80'1c00) >> 4)
 
 namespace SPU {
 
 	std::shared_ptr<spdlog::logger> console = spdlog::stdout_color_mt("SPU");
 
-	byte* memory = new byte[0x8'0000] { 0x0000 };		//	512k
+	thread_local byte* memory = nullptr;		//	512k
 
 	union SPUSTAT {
 		struct {
@@ -18,7 +20,8 @@ namespace SPU {
 			u16 : 4;
 		} flags;
 		u16 raw;
-	} spustat;
+	};
+	thread_local SPUSTAT spustat;
 	static_assert(sizeof(spustat) == sizeof(u16), "Union not at the expected size!");
 
 	union SPUCNT {
@@ -36,42 +39,49 @@ namespace SPU {
 			u16 spu_enable : 1;
 		} flags;
 		u16 raw;
-	} spucnt;
+	};
+	thread_local SPUCNT spucnt;
 	static_assert(sizeof(spucnt) == sizeof(u16), "Union not at the expected size!");
 
 	//	voice registers
-	MainVolume voice_volume_left[24];
-	MainVolume voice_volume_right[24];
-	u16 adpcm_sample_rate[24];
-	u16 adsr_current_volume[24];
+	thread_local MainVolume voice_volume_left[24];
+	thread_local MainVolume voice_volume_right[24];
+	thread_local u16 adpcm_sample_rate[24];
+	thread_local u16 adsr_current_volume[24];
 
 	//	control registers
-	MainVolume main_volume_left;
-	MainVolume main_volume_right;
-	i16 reverb_output_volume_left = 0;
-	i16 reverb_output_volume_right = 0;
-
-	u32 voice_key_on = 0;
-	u32 voice_key_off = 0;
-	u32 voice_on_off = 0;
-	u32 pitch_modulation_enable_flags = 0;
-	u32 voice_noise = 0;
-	u32 voice_reverb_mode = 0;
-
-	u16 sound_ram_reverb_work_area_start_address = 0;
-	u16 sound_ram_data_transfer_address = 0;
-	u16 sound_ram_data_transfer_fifo = 0;
-	u16 sound_ram_data_transfer_type = 0;
+	thread_local MainVolume main_volume_left;
+	thread_local MainVolume main_volume_right;
+	thread_local i16 reverb_output_volume_left = 0;
+	thread_local i16 reverb_output_volume_right = 0;
+
+	thread_local u32 voice_key_on = 0;
+	thread_local u32 voice_key_off = 0;
+	thread_local u32 voice_on_off = 0;
+	thread_local u32 pitch_modulation_enable_flags = 0;
+	thread_local u32 voice_noise = 0;
+	thread_local u32 voice_reverb_mode = 0;
+
+	thread_local u16 sound_ram_reverb_work_area_start_address = 0;
+	thread_local u16 sound_ram_data_transfer_address = 0;
+	thread_local u16 sound_ram_data_transfer_fifo = 0;
+	thread_local u16 sound_ram_data_transfer_type = 0;
 	
-	Volume cd_audio_input_volume;
-	Volume external_audio_input_volume;
+	thread_local Volume cd_audio_input_volume;
+	thread_local Volume external_audio_input_volume;
 
 	//	reverb configuration area
-	u16 reverb_configuration_area[0x40];
+	thread_local u16 reverb_configuration_area[0x40];
 }
 
 void SPU::init() {
 	console->info("SPU init");
+	memory = new byte[0x8'0000] { 0x0000 };
+}
+
+void SPU::shutdown() {
+	delete[] memory;
+	memory = nullptr;
 }
 
 void SPU::write32bRegister(u32* reg, u16 data, bool upperHWord) {
@@ -208,4 +218,73 @@ u16 SPU::readSoundRAMDataTransferControl() {
 
 u16 SPU::readVoiceCurrentADSRVolume(u8 voice) {
 	return adsr_current_volume[voice];
-}
\ No newline at end of file
+}
+
+void SPU::mapIO() {
+	//	everything in the control area that isn't one of its registers
+	IO::mapReadRange(0x1f80'1d80, 0x1f80'2000, [](word address) -> u32 {
+		console->error("SPU read detected at {0:x}", address);
+		exit(1);
+	});
+	IO::mapWriteRange(0x1f80'1d80, 0x1f80'2000, [](word address, u32) {
+		console->error("SPU Write detected to {0:x}", address);
+		exit(1);
+	});
+
+	//	Voice registers
+	for (u8 voice = 0; voice < 24; voice++) {
+		IO::mapRead(0x1f80'1c0c + 0x10 * voice, [](word address) -> u32 {
+			return readVoiceCurrentADSRVolume(SPU_VOICE(address));
+		});
+	}
+	IO::mapWriteRange(0x1f80'1c00, 0x1f80'1d80, [](word address, u32 data) {
+		switch (address & 0b1111) {
+		case 0: writeVoiceVolumeLeft(data, SPU_VOICE(address)); break;
+		case 2: writeVoiceVolumeRight(data, SPU_VOICE(address)); break;
+		case 4: writeVoiceADPCMSampleRate(data, SPU_VOICE(address)); break;
+		}
+	});
+
+	//	Control registers
+	IO::mapRead(0x1f80'1dae, [](word) -> u32 { return readSPUSTAT(); });
+	IO::mapRead(0x1f80'1daa, [](word) -> u32 { return readSPUCNT(); });
+	IO::mapRead(0x1f80'1d88, [](word) -> u32 { return readVoiceKeyOn(); });
+	IO::mapRead(0x1f80'1d8a, [](word) -> u32 { return readVoiceKeyOn(true); });
+	IO::mapRead(0x1f80'1d8c, [](word) -> u32 { return readVoiceKeyOff(); });
+	IO::mapRead(0x1f80'1d8e, [](word) -> u32 { return readVoiceKeyOff(true); });
+	IO::mapRead(0x1f80'1d9c, [](word) -> u32 { return readVoiceOnOff(); });
+	IO::mapRead(0x1f80'1da6, [](word) -> u32 { return readSoundRAMDataTransferAddress(); });
+	IO::mapRead(0x1f80'1da8, [](word) -> u32 { return readSoundRAMDataTransferFifo(); });
+	IO::mapRead(0x1f80'1dac, [](word) -> u32 { return readSoundRAMDataTransferControl(); });
+
+	IO::mapWrite(0x1f80'1dae, [](word, u32) {});		//	SPUSTAT is read only
+	IO::mapWrite(0x1f80'1daa, [](word, u32 data) { writeSPUCNT(data); });
+	IO::mapWrite(0x1f80'1d80, [](word, u32 data) { writeMainVolumeLeft(data); });
+	IO::mapWrite(0x1f80'1d82, [](word, u32 data) { writeMainVolumeRight(data); });
+	IO::mapWrite(0x1f80'1d84, [](word, u32 data) { writeReverbOutputVolumeLeft(data); });
+	IO::mapWrite(0x1f80'1d86, [](word, u32 data) { writeReverbOutputVolumeRight(data); });
+	IO::mapWrite(0x1f80'1d88, [](word, u32 data) { writeVoiceKeyOn(data); });
+	IO::mapWrite(0x1f80'1d8a, [](word, u32 data) { writeVoiceKeyOn(data, true); });
+	IO::mapWrite(0x1f80'1d8c, [](word, u32 data) { writeVoiceKeyOff(data); });
+	IO::mapWrite(0x1f80'1d8e, [](word, u32 data) { writeVoiceKeyOff(data, true); });
+	IO::mapWrite(0x1f80'1d90, [](word, u32 data) { writePitchModulationEnableFlags(data); });
+	IO::mapWrite(0x1f80'1d92, [](word, u32 data) { writePitchModulationEnableFlags(data, true); });
+	IO::mapWrite(0x1f80'1d94, [](word, u32 data) { writeVoiceNoise(data); });
+	IO::mapWrite(0x1f80'1d96, [](word, u32 data) { writeVoiceNoise(data, true); });
+	IO::mapWrite(0x1f80'1d98, [](word, u32 data) { writeVoiceReverbMode(data); });
+	IO::mapWrite(0x1f80'1d9a, [](word, u32 data) { writeVoiceReverbMode(data, true); });
+	IO::mapWrite(0x1f80'1d9c, [](word, u32 data) { writeVoiceOnOff(data); });
+	IO::mapWrite(0x1f80'1da2, [](word, u32 data) { writeSoundRAMDataReverbWorkAreaStartAddress(data); });
+	IO::mapWrite(0x1f80'1da6, [](word, u32 data) { writeSoundRAMDataTransferAddress(data); });
+	IO::mapWrite(0x1f80'1da8, [](word, u32 data) { writeSoundRAMDataTransferFifo(data); });
+	IO::mapWrite(0x1f80'1dac, [](word, u32 data) { writeSoundRAMDataTransferControl(data); });
+	IO::mapWrite(0x1f80'1db0, [](word, u32 data) { writeCDAudioInputVolume(data); });
+	IO::mapWrite(0x1f80'1db2, [](word, u32 data) { writeCDAudioInputVolume(data, true); });
+	IO::mapWrite(0x1f80'1db4, [](word, u32 data) { writeExternalAudioInputVolume(data); });
+	IO::mapWrite(0x1f80'1db6, [](word, u32 data) { writeExternalAudioInputVolume(data, true); });
+
+	//	Reverb configuration
+	IO::mapWriteRange(0x1f80'1dc0, 0x1f80'1e00, [](word address, u32 data) {
+		writeReverbConfiguration(data, address - 0x1f80'1dc0);
+	});
+}
@@ -35,16 +35,18 @@ namespace SPU {
 		u16 raw;
 	};
 
-	extern u32 voice_key_on;
-	extern u32 voice_key_off;
-	extern u32 voice_on_off;
-	extern u32 pitch_modulation_enable_flags;
-	extern u32 voice_noise;
-	extern u32 voice_reverb_mode;
-	extern Volume cd_audio_input_volume;
-	extern Volume external_audio_input_volume;
+	extern thread_local u32 voice_key_on;
+	extern thread_local u32 voice_key_off;
+	extern thread_local u32 voice_on_off;
+	extern thread_local u32 pitch_modulation_enable_flags;
+	extern thread_local u32 voice_noise;
+	extern thread_local u32 voice_reverb_mode;
+	extern thread_local Volume cd_audio_input_volume;
+	extern thread_local Volume external_audio_input_volume;
 
 	void init();
+	void shutdown();
+	void mapIO();
 
 	void write32bRegister(u32* reg, u16 data, bool upperHWord = false);
 	u16 read32bRegister(u32* reg, bool upperHWord = false);
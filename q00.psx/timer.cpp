@@ -1,10 +1,12 @@
 #include "timer.h"
+#include "io.h"
+#define TIMER_COUNTER(address) ((address - 0x1f80'1100) >> 4)
 
 static auto console = spdlog::stdout_color_mt("Timer");
 
 namespace Timer {
-	u32 current_counter[3];
-	u32 counter_target[3];
+	thread_local u32 current_counter[3];
+	thread_local u32 counter_target[3];
 
 	enum class SYNC_ENABLE : u32 { free_run = 0, use_sync_modes = 1 };
 	enum class SYNC_MODE_0 : u32 { pause_counter_during_hblank = 0, reset_counter_to_0000_at_hblank = 1, reset_counter_to_0000_at_hblank_and_pause_outside_of_hblank = 2, pause_until_hblank_occurs_once_then_freerun = 3 };
@@ -64,7 +66,8 @@ namespace Timer {
 			u32 : 19;
 		} counter_2;
 		u32 raw;
-	} counter_mode;
+	};
+	thread_local Counter_Mode counter_mode;
 	static_assert(sizeof(Counter_Mode) == sizeof(u32), "Union not at the expected size!");
 }
 
@@ -98,6 +101,20 @@ u32 Timer::readCounterTarget(u8 timer) {
 	return counter_target[timer];
 }
 
+void Timer::mapIO() {
+	IO::mapReadRange(0x1f80'1100, 0x1f80'1128, [](word address) -> u32 {
+		console->error("Implement timers, bitch! {0:x}", address);
+		exit(1);
+	});
+	for (u8 counter = 0; counter < 3; counter++) {
+		const word base = 0x1f80'1100 + 0x10 * counter;
+		IO::mapRead(base, [](word address) -> u32 { return readCurrentCounter(TIMER_COUNTER(address)); });
+		IO::mapRead(base + 4, [](word address) -> u32 { return readCounterMode(TIMER_COUNTER(address)); });
+		IO::mapRead(base + 8, [](word address) -> u32 { return readCounterTarget(TIMER_COUNTER(address)); });
+	}
+	//	writes are dropped until the counters really count
+}
+
 void Timer::tick() {
 	current_counter[0]++;
 	current_counter[1]++;
@@ -15,6 +15,7 @@ namespace Timer {
 	u32 readCounterMode(u8 timer);
 	u32 readCounterTarget(u8 timer);
 
+	void mapIO();
 	void tick();
 }
 
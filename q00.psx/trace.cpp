@@ -0,0 +1,50 @@
+#include "trace.h"
+#include <fstream>
+#include <string>
+#include "include/spdlog/spdlog.h"
+#include "include/spdlog/sinks/stdout_color_sinks.h"
+
+static auto console = spdlog::stdout_color_mt("Trace");
+
+namespace Trace {
+	bool enabled = false;
+	Entry* buffer = nullptr;
+	u64 head = 0;
+
+	std::string traceFilename;
+}
+
+void Trace::init(const char* filename) {
+	buffer = new Entry[TRACE_ENTRIES];
+	head = 0;
+	traceFilename = filename;
+	enabled = true;
+	console->info("Tracing to {0:s} (last {1:d} instructions)", filename, TRACE_ENTRIES);
+}
+
+//	writes the ring oldest entry first
+void Trace::save() {
+	if (!enabled) {
+		return;
+	}
+
+	std::ofstream fout(traceFilename, std::ios::binary | std::ios::out);
+	if (!fout.is_open()) {
+		console->error("Could not open {0:s}", traceFilename);
+		return;
+	}
+
+	const u64 count = (head < TRACE_ENTRIES) ? head : TRACE_ENTRIES;
+	const u64 first = head - count;
+	const FileHeader header = { TRACE_MAGIC, TRACE_VERSION, sizeof(Entry), 0, head, count };
+	fout.write((const char*)&header, sizeof(header));
+
+	//	oldest part of the ring up to its end, then the wrapped around part
+	const u64 start = first & (TRACE_ENTRIES - 1);
+	const u64 tail = (start + count > TRACE_ENTRIES) ? TRACE_ENTRIES - start : count;
+	fout.write((const char*)&buffer[start], tail * sizeof(Entry));
+	fout.write((const char*)&buffer[0], (count - tail) * sizeof(Entry));
+	fout.close();
+
+	console->info("Wrote {0:d} of {1:d} traced instructions to {2:s}", count, head, traceFilename);
+}
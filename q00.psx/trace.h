@@ -0,0 +1,48 @@
+#pragma once
+#ifndef TRACE_GUARD
+#define TRACE_GUARD
+#include "defs.h"
+#define TRACE_MAGIC 0x5254'3051		//	"Q0TR"
+#define TRACE_VERSION 1
+#define TRACE_ENTRIES (1 << 22)		//	64MB ring, has to be a power of 2
+
+/*
+	Binary CPU trace, enabled with --trace <file>.
+	Every executed instruction goes into a ring buffer as one 16 byte entry, the last
+	TRACE_ENTRIES of them are written out when the emulator exits (also through exit(1)
+	after an error). q00.psx.tracedump decodes and disassembles the file.
+	The recompiler doesn't trace, --trace runs the interpreters only.
+*/
+namespace Trace {
+
+	struct FileHeader {
+		u32 magic;
+		u32 version;
+		u32 entrySize;
+		u32 reserved;
+		u64 recorded;		//	instructions recorded over the whole run
+		u64 count;			//	entries that follow, oldest first
+	};
+
+	//	rt / rd are the register values after the instruction, the decoder picks the one that was written
+	struct Entry {
+		u32 pc;
+		u32 opcode;
+		u32 rt;
+		u32 rd;
+	};
+	static_assert(sizeof(Entry) == 16, "Trace entry not at the expected size!");
+
+	extern bool enabled;
+	extern Entry* buffer;
+	extern u64 head;
+
+	void init(const char* filename);
+	void save();
+
+	inline void record(word pc, word opcode, u32 rt, u32 rd) {
+		buffer[head++ & (TRACE_ENTRIES - 1)] = { pc, opcode, rt, rd };
+	}
+}
+
+#endif
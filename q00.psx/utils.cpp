@@ -1,7 +1,7 @@
 #include "defs.h"
 #include "utils.h"
 
-word Utils::readWord(byte* mem, word address) {
+word Utils::readWord(const byte* mem, word address) {
 	word res = 0x00'00;
 	res = mem[address + 3];
 	res <<= 8;
@@ -13,6 +13,18 @@ word Utils::readWord(byte* mem, word address) {
 	return res;
 }
 
-char Utils::readChar(byte* mem, word address) {
+char Utils::readChar(const byte* mem, word address) {
 	return mem[address];
 }
+
+//	CRC-32 (zlib / PNG), the checksum BIOS dumps are usually listed with
+u32 Utils::crc32(const byte* data, u32 size) {
+	u32 crc = 0xffff'ffff;
+	for (u32 i = 0; i < size; i++) {
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc >> 1) ^ (0xedb8'8320 & (0 - (crc & 1)));
+		}
+	}
+	return ~crc;
+}
@@ -4,8 +4,9 @@
 #include "defs.h"
 
 namespace Utils {
-	word readWord(byte* mem, word address);
-	char readChar(byte* mem, word address);
+	word readWord(const byte* mem, word address);
+	char readChar(const byte* mem, word address);
+	u32 crc32(const byte* data, u32 size);
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,144 @@
+#pragma once
+#ifndef X64EMITTER_GUARD
+#define X64EMITTER_GUARD
+#include "defs.h"
+#include <string.h>
+
+//	Minimal x86-64 machine code emitter, only what the recompiler needs
+namespace X64 {
+
+	enum Reg : u8 {
+		RAX = 0, RCX = 1, RDX = 2, RBX = 3, RSP = 4, RBP = 5, RSI = 6, RDI = 7,
+		R8 = 8, R9 = 9, R10 = 10, R11 = 11, R12 = 12, R13 = 13, R14 = 14, R15 = 15
+	};
+
+	//	ALU opcode extensions (81 /ext) and their reg,reg forms (op r/m32, r32)
+	enum class ALU : u8 { ADD = 0, OR = 1, AND = 4, SUB = 5, XOR = 6, CMP = 7 };
+	enum class Shift : u8 { SHL = 4, SHR = 5, SAR = 7 };
+	enum class Cond : u8 { B = 0x2, AE = 0x3, E = 0x4, NE = 0x5, BE = 0x6, A = 0x7, L = 0xc, GE = 0xd, LE = 0xe, G = 0xf };
+
+	struct Emitter {
+		u8* start = nullptr;
+		u8* ptr = nullptr;
+		u8* end = nullptr;
+
+		void reset(u8* buffer, size_t size) {
+			start = ptr = buffer;
+			end = buffer + size;
+		}
+
+		size_t remaining() const {
+			return end - ptr;
+		}
+
+		void emit8(u8 v) { *ptr++ = v; }
+		void emit32(u32 v) { memcpy(ptr, &v, 4); ptr += 4; }
+		void emit64(u64 v) { memcpy(ptr, &v, 8); ptr += 8; }
+
+		void rex(bool w, u8 reg, u8 rm) {
+			u8 r = 0x40 | (w << 3) | (((reg >> 3) & 1) << 2) | ((rm >> 3) & 1);
+			if (r != 0x40) {
+				emit8(r);
+			}
+		}
+
+		void modrm(u8 mod, u8 reg, u8 rm) {
+			emit8((mod << 6) | ((reg & 7) << 3) | (rm & 7));
+		}
+
+		//	[base + disp32], base must not be rsp / r12
+		void memOperand(u8 reg, Reg base, i32 disp) {
+			modrm(0b10, reg, base);
+			emit32(disp);
+		}
+
+		//	mov r32, [base + disp]
+		void movLoad(Reg dst, Reg base, i32 disp) { rex(false, dst, base); emit8(0x8b); memOperand(dst, base, disp); }
+		//	mov [base + disp], r32
+		void movStore(Reg base, i32 disp, Reg src) { rex(false, src, base); emit8(0x89); memOperand(src, base, disp); }
+		//	mov dword [base + disp], imm32
+		void movStoreImm(Reg base, i32 disp, u32 imm) { rex(false, 0, base); emit8(0xc7); memOperand(0, base, disp); emit32(imm); }
+		//	mov r32, imm32
+		void movImm(Reg dst, u32 imm) { rex(false, 0, dst); emit8(0xb8 + (dst & 7)); emit32(imm); }
+		//	mov r64, imm64
+		void movImm64(Reg dst, u64 imm) { rex(true, 0, dst); emit8(0xb8 + (dst & 7)); emit64(imm); }
+		//	mov r32, r32
+		void mov(Reg dst, Reg src) { rex(false, src, dst); emit8(0x89); modrm(0b11, src, dst); }
+		//	mov r64, r64
+		void mov64(Reg dst, Reg src) { rex(true, src, dst); emit8(0x89); modrm(0b11, src, dst); }
+		//	mov r64, [r64]
+		void movLoad64(Reg dst, Reg base) { rex(true, dst, base); emit8(0x8b); modrm(0b00, dst, base); }
+		//	mov r64, [base + disp]
+		void movLoad64(Reg dst, Reg base, i32 disp) { rex(true, dst, base); emit8(0x8b); memOperand(dst, base, disp); }
+		//	mov [base + disp], r64
+		void movStore64(Reg base, i32 disp, Reg src) { rex(true, src, base); emit8(0x89); memOperand(src, base, disp); }
+
+		//	op r32, r32
+		void alu(ALU op, Reg dst, Reg src) { rex(false, src, dst); emit8(((u8)op << 3) | 0x01); modrm(0b11, src, dst); }
+		//	op r32, imm32
+		void aluImm(ALU op, Reg dst, u32 imm) { rex(false, 0, dst); emit8(0x81); modrm(0b11, (u8)op, dst); emit32(imm); }
+		//	add r64, r64
+		void add64(Reg dst, Reg src) { rex(true, src, dst); emit8(0x01); modrm(0b11, src, dst); }
+		//	cmp r64, r64
+		void cmp64(Reg a, Reg b) { rex(true, b, a); emit8(0x39); modrm(0b11, b, a); }
+		//	add qword [base + disp], imm32
+		void add64MemImm(Reg base, i32 disp, u32 imm) { rex(true, 0, base); emit8(0x81); memOperand(0, base, disp); emit32(imm); }
+
+		void notReg(Reg dst) { rex(false, 0, dst); emit8(0xf7); modrm(0b11, 2, dst); }
+		void shiftImm(Shift op, Reg dst, u8 amount) { rex(false, 0, dst); emit8(0xc1); modrm(0b11, (u8)op, dst); emit8(amount); }
+		void shiftCL(Shift op, Reg dst) { rex(false, 0, dst); emit8(0xd3); modrm(0b11, (u8)op, dst); }
+
+		//	edx:eax = eax * r32
+		void imul(Reg src) { rex(false, 0, src); emit8(0xf7); modrm(0b11, 5, src); }
+		void mul(Reg src) { rex(false, 0, src); emit8(0xf7); modrm(0b11, 4, src); }
+
+		//	setcc r8 (only al / cl / dl / bl, so no REX is needed) + movzx r32, r8
+		void setcc(Cond cc, Reg dst) { emit8(0x0f); emit8(0x90 | (u8)cc); modrm(0b11, 0, dst); }
+		void movzx8(Reg dst, Reg src) { rex(false, dst, src); emit8(0x0f); emit8(0xb6); modrm(0b11, dst, src); }
+		void movsx8(Reg dst, Reg src) { rex(false, dst, src); emit8(0x0f); emit8(0xbe); modrm(0b11, dst, src); }
+		void movzx16(Reg dst, Reg src) { rex(false, dst, src); emit8(0x0f); emit8(0xb7); modrm(0b11, dst, src); }
+		void movsx16(Reg dst, Reg src) { rex(false, dst, src); emit8(0x0f); emit8(0xbf); modrm(0b11, dst, src); }
+
+		//	loads through [r64] (base must not be rsp / rbp / r12 / r13)
+		void movLoadIndirect(Reg dst, Reg base) { rex(false, dst, base); emit8(0x8b); modrm(0b00, dst, base); }
+		void movzx8Indirect(Reg dst, Reg base) { rex(false, dst, base); emit8(0x0f); emit8(0xb6); modrm(0b00, dst, base); }
+		void movzx16Indirect(Reg dst, Reg base) { rex(false, dst, base); emit8(0x0f); emit8(0xb7); modrm(0b00, dst, base); }
+
+		//	[base + index], low registers only (no REX), base must not be rbp
+		void indexedOperand(u8 reg, Reg base, Reg index) {
+			modrm(0b00, reg, 0b100);
+			emit8(((index & 7) << 3) | (base & 7));
+		}
+		void movLoadIndexed(Reg dst, Reg base, Reg index) { emit8(0x8b); indexedOperand(dst, base, index); }
+		void movzx8Indexed(Reg dst, Reg base, Reg index) { emit8(0x0f); emit8(0xb6); indexedOperand(dst, base, index); }
+		void movzx16Indexed(Reg dst, Reg base, Reg index) { emit8(0x0f); emit8(0xb7); indexedOperand(dst, base, index); }
+		//	mov [base + index], r8 / r16 / r32 (r8 only al / cl / dl / bl)
+		void movStore8Indexed(Reg base, Reg index, Reg src) { emit8(0x88); indexedOperand(src, base, index); }
+		void movStore16Indexed(Reg base, Reg index, Reg src) { emit8(0x66); emit8(0x89); indexedOperand(src, base, index); }
+		void movStoreIndexed(Reg base, Reg index, Reg src) { emit8(0x89); indexedOperand(src, base, index); }
+
+		//	cmp byte [r64], imm8
+		void cmpByteIndirect(Reg base, u8 imm) { rex(false, 0, base); emit8(0x80); modrm(0b00, 7, base); emit8(imm); }
+
+		void push(Reg r) { rex(false, 0, r); emit8(0x50 + (r & 7)); }
+		void pop(Reg r) { rex(false, 0, r); emit8(0x58 + (r & 7)); }
+		void subRSP(u8 imm) { emit8(0x48); emit8(0x83); emit8(0xec); emit8(imm); }
+		void addRSP(u8 imm) { emit8(0x48); emit8(0x83); emit8(0xc4); emit8(imm); }
+		void ret() { emit8(0xc3); }
+
+		//	call an absolute address through rax
+		void call(const void* target) { movImm64(RAX, (u64)target); emit8(0xff); emit8(0xd0); }
+
+		//	jumps, returning the location of the rel32 so it can be bound later
+		u8* jcc(Cond cc) { emit8(0x0f); emit8(0x80 | (u8)cc); u8* at = ptr; emit32(0); return at; }
+		u8* jmp() { emit8(0xe9); u8* at = ptr; emit32(0); return at; }
+		//	jmp r64
+		void jmpReg(Reg target) { rex(false, 0, target); emit8(0xff); modrm(0b11, 4, target); }
+		void bind(u8* rel32) { bindTo(rel32, ptr); }
+		void bindTo(u8* rel32, const u8* target) { i32 rel = (i32)(target - (rel32 + 4)); memcpy(rel32, &rel, 4); }
+		//	jmp rel32 written over existing code (5 bytes)
+		static void patchJump(u8* at, const u8* target) { at[0] = 0xe9; i32 rel = (i32)(target - (at + 5)); memcpy(at + 1, &rel, 4); }
+	};
+}
+
+#endif